@@ -20,14 +20,27 @@
 #
 
 
-from collections import deque
+from collections import deque, OrderedDict
+from collections.abc import Iterator
+from concurrent.futures import ThreadPoolExecutor, ProcessPoolExecutor
+from functools import partial
+from itertools import count
+from logging import DEBUG
+from time import monotonic, perf_counter_ns
 
 from mood.event import fatal, EV_READ
 
-from .connections import Connection, Overwatch
+from .connections import Connection, RingConnection, Overwatch
 from .loops import watcher, ServerLoop, ClientLoop
-from .pack import encode, size, unpack
-from .sockets import ServerSocket, ClientSocket
+from .pack import (
+    encodecall, encodedata, encodeid, pack, serve, servekey, unpack, unpackid
+)
+from .sockets import ServerSocket, ClientSocket, Channel
+
+try:
+    from .sockets import Ring
+except ImportError: # built without io_uring support
+    Ring = None
 
 
 class CriticalError(Exception):
@@ -37,11 +50,116 @@ class RequestError(RuntimeError):
     pass
 
 
+# items a stream sends ahead of the client consuming them
+__window__ = 64
+
+# bytes queued for a client above which its requests stop being read, and
+# below which they are read again
+__watermarks__ = (1 << 20, 1 << 18)
+
+
+# deadlines --------------------------------------------------------------------
+
+# requests carry the caller's timeout, relative as clocks are not shared
+# across hosts; the server turns it into a time.monotonic() deadline of its own
+# from the time the request was read off the connection (see _stamp), not from
+# when it gets to it
+
+def __expired__():
+    return TimeoutError("deadline expired")
+
+def __expire__(deadline, method, args, kwargs): # executor
+    # the caller gave up while this was queued
+    if monotonic() > deadline:
+        return __expired__()
+    return method(*args, **kwargs)
+
+
 # public decorator -------------------------------------------------------------
 
-def public(func):
-    func.__public__ = True
-    return func
+__executors__ = {"threads": ThreadPoolExecutor, "processes": ProcessPoolExecutor}
+
+def public(
+    func=None, *, executor=None, max_workers=None, oneway=False, cache=None
+):
+    if executor and executor not in __executors__:
+        raise ValueError(f"unknown executor: '{executor}'")
+    if cache is not None and (
+        isinstance(cache, bool) or
+        not isinstance(cache, (int, float)) or
+        cache <= 0
+    ):
+        raise ValueError(f"invalid cache: {cache!r}")
+    def decorator(func):
+        func.__public__ = True
+        if executor: # run on a pool instead of the loop
+            func.__executor__ = (executor, max_workers)
+        if oneway: # clients do not wait for (nor get) a reply
+            func.__oneway__ = True
+        if cache: # results are reused for the same arguments
+            func.__cache__ = cache
+        return func
+    return decorator(func) if func else decorator
+
+
+# result cache -----------------------------------------------------------------
+
+# packed results of a method, keyed on its args[, kwargs] as clients packed
+# them; a float ttl_or_size is how long (in seconds) they are kept, an int how
+# many (the least recently used are dropped)
+
+# entries a ttl cache holds at most, the first to expire are dropped first
+__cachesize__ = 1 << 12
+
+class Cache(object):
+
+    def __init__(self, ttl_or_size):
+        if isinstance(ttl_or_size, float):
+            self._ttl, self._size = ttl_or_size, __cachesize__
+        else:
+            self._ttl, self._size = 0, ttl_or_size
+        self._entries = OrderedDict() # key -> (data, expiry)
+        self.hits = self.misses = 0
+
+    def __len__(self):
+        return len(self._entries)
+
+    def __lookup__(self, key):
+        if (entry := self._entries.get(key)):
+            data, expiry = entry
+            if not expiry or monotonic() < expiry:
+                if not expiry: # least recently used first
+                    self._entries.move_to_end(key)
+                self.hits += 1
+                return data
+            del self._entries[key]
+        self.misses += 1
+        return None
+
+    def __store__(self, key, data):
+        entries = self._entries
+        if self._ttl:
+            now = monotonic()
+            # same ttl for all, the first to expire come first
+            while entries and next(iter(entries.values()))[1] <= now:
+                entries.popitem(last=False)
+            entries[key] = (data, now + self._ttl)
+        else:
+            entries[key] = (data, 0)
+        entries.move_to_end(key)
+        if len(entries) > self._size:
+            entries.popitem(last=False)
+
+    def invalidate(self, *args, **kwargs):
+        # the key is what clients send, kwargs only when not empty
+        key = bytes(pack(args) + pack(kwargs)) if kwargs else bytes(pack(args))
+        return self._entries.pop(key, None) is not None
+
+    def clear(self):
+        self._entries.clear()
+
+    def stats(self):
+        return {"hits": self.hits, "misses": self.misses, "size": len(self)}
 
 
 # ------------------------------------------------------------------------------
@@ -52,29 +170,66 @@ class IPPCClient(Connection):
     def __init__(self, handler, *args, **kwargs):
         super().__init__(*args, **kwargs)
         self._handler = handler
+        self._streams = {} # request id -> [iterator, credits]
+        self._futures = {} # request id -> executor future
         self.wait()
 
-    def __on_request__(self, buf):
-        self.write(self._handler(buf), self.wait)
+    def __cleanup__(self):
+        self._streams.clear()
+        self._futures.clear()
+        super().__cleanup__()
 
-    def __on_size__(self, buf):
-        self.read(size(buf), self.__on_request__)
+    def __on_request__(self, buf):
+        # keep reading, requests may be pipelined
+        self.write(self._handler(self, buf))
+        self.wait()
 
-    def __on_len__(self, buf):
-        self.read(buf[0], self.__on_size__)
+    def __handshake__(self): # the client sent a channel along
+        self.__upgrade__(Channel(fds=self._socket.recvfds()))
 
     def wait(self):
-        self.read(1, self.__on_len__)
+        self.receive(self.__on_request__)
+
+
+class IPPCRingClient(IPPCClient, RingConnection):
+    pass
 
 
 class Server(ServerLoop):
 
     def __init__(self, **kwargs):
         super().__init__(**kwargs)
+        self._socket = None
+        self._ring = None
+        self._watermarks = None
         self._clients = deque()
         self._methods = {}
         for item in kwargs.items():
             self._methods.update(self.__methods__(*item))
+        # method ids index the dispatch table, clients fetch _names
+        self._names = tuple(self._methods)
+        self._ids = {name: mid for mid, name in enumerate(self._names)}
+        self._oneway = tuple(
+            mid for mid, name in enumerate(self._names)
+            if getattr(self._methods[name], "__oneway__", False)
+        )
+        self._table = ()
+        self._inline = ()
+        self._offload = {
+            name: executor for name, method in self._methods.items()
+            if (executor := getattr(method, "__executor__", None))
+        }
+        self._executors = {}
+        self._caches = {
+            name: Cache(cache) for name, method in self._methods.items()
+            if (cache := getattr(method, "__cache__", None))
+        }
+        # requests name methods by id or by name
+        self._cached = {}
+        for name, cache in self._caches.items():
+            self._cached[name] = self._cached[self._ids[name]] = cache
+        self._completed = deque()
+        self._completion = None
 
     def __methods__(self, key, value):
         for name in dir(value):
@@ -89,23 +244,227 @@ class Server(ServerLoop):
     def __on_close__(self, client):
         self._clients.remove(client)
 
-    def __on_request__(self, buf):
+    def __on_pressure__(self, client, paused):
+        if paused:
+            self.pausing(client)
+        else:
+            self.resuming(client)
+
+    def __client__(self, cls, *args):
+        client = cls(
+            self.__on_request__, *args, self._logger, on_close=self.__on_close__
+        )
+        if self._watermarks:
+            client.watermarks(*self._watermarks, self.__on_pressure__)
+        self._clients.append(client)
+
+    def __error__(self, err):
+        if isinstance(err, CriticalError):
+            raise err
+        self._logger.error(f"{self}: error processing request", exc_info=err)
+        return err
+
+    def __encode__(self, rid, result):
+        # request id 0 is a notification, it gets no reply
+        return encodeid(rid, result) if rid else None
+
+    def __method__(self, name):
+        try:
+            return self._table[
+                name if type(name) is int and name >= 0 else self._ids[name]
+            ]
+        except (IndexError, KeyError):
+            raise AttributeError(f"no method '{name}'") from None
+
+    def __memoise__(self, cache, key, rid, result):
+        # errors and streams are not kept
+        if isinstance(result, (Exception, Iterator)):
+            return self.__encode__(rid, result)
+        cache.__store__(key, (data := pack(result)))
+        return encodedata(rid, data) if rid else None
+
+    # streams ------------------------------------------------------------------
+
+    def __pump__(self, client, rid, stream):
+        # frames are (rid, item, True) then a last (rid, None|error, False)
+        iterator, credits = stream
+        try:
+            while credits and not client.closed:
+                client.write(encodeid(rid, next(iterator), True))
+                credits -= 1
+        except StopIteration:
+            end = None
+        except Exception as err:
+            end = self.__error__(err)
+        else:
+            stream[1] = credits
+            return
+        del client._streams[rid]
+        if not client.closed:
+            client.write(encodeid(rid, end, False))
+
+    def __stream__(self, client, rid, iterator):
+        stream = client._streams[rid] = [iterator, __window__]
+        self.__pump__(client, rid, stream)
+
+    def __credit__(self, client, rid, credits):
+        if (stream := client._streams.get(rid)):
+            if credits > 0:
+                stream[1] += credits
+                self.__pump__(client, rid, stream)
+            else: # cancelled
+                del client._streams[rid]
+                if (close := getattr(stream[0], "close", None)):
+                    close()
+                client.write(encodeid(rid, None, False))
+        elif not credits:
+            self.__cancel__(client, rid)
+
+    def __cancel__(self, client, rid):
+        # only possible while still queued, __reply__ is called either way
+        if (future := client._futures.get(rid)):
+            future.cancel()
+
+    # --------------------------------------------------------------------------
+
+    def __batch__(self, client, rid, calls, deadline=None):
+        # run in order, offloaded methods are waited for before replying
+        results, pending = [], {}
+        for name, args, kwargs in calls:
+            result = None
+            try:
+                method, executor = self.__method__(name)
+                if deadline and monotonic() > deadline:
+                    result = __expired__()
+                elif executor:
+                    future = (
+                        executor.submit(__expire__, deadline, method, args, kwargs)
+                        if deadline else executor.submit(method, *args, **kwargs)
+                    )
+                    pending[future] = len(results)
+                else:
+                    result = method(*args, **kwargs)
+            except Exception as err:
+                result = self.__error__(err)
+            results.append(result)
+        if not pending:
+            return self.__encode__(rid, results)
+        cb = partial(self.__on_part__, client, rid, results, pending)
+        for future in tuple(pending):
+            future.add_done_callback(partial(self.__on_done__, cb))
+        return None # replied to from __on_part__
+
+    def __on_request__(self, client, buf):
+        rid = 0
         try:
             try:
-                name, args, kwargs = unpack(buf)
                 try:
-                    result = self._methods[name](*args, **kwargs)
-                except KeyError:
-                    raise AttributeError(f"no method '{name}'") from None
-            except CriticalError as err:
-                raise err
+                    # inline methods called by id are served natively
+                    if (reply := serve(buf, self._inline)) is not NotImplemented:
+                        if type(reply) is tuple: # (rid, iterator)
+                            return self.__stream__(client, *reply)
+                        return reply
+                    cache = key = None
+                    if self._cached: # cached methods are not served natively
+                        rid, name, key = servekey(buf)
+                        if (
+                            ((cache := self._cached.get(name)) is not None) and
+                            ((data := cache.__lookup__(key)) is not None)
+                        ):
+                            return encodedata(rid, data) if rid else None
+                    rid, name, args, *extra = unpackid(buf)
+                except Exception:
+                    rid = unpack(buf) # the request id comes first
+                    raise
+                if name is None:
+                    if args: # (rid, n): n more items for stream rid, 0 cancels
+                        return self.__credit__(client, *args)
+                    # the method table
+                    return encodeid(rid, (self._names, self._oneway))
+                # (kwargs[, timeout])
+                kwargs = extra[0] if extra else {}
+                deadline = None
+                if len(extra) > 1:
+                    deadline = client._stamp + extra[1]
+                    if monotonic() >= deadline: # the caller gave up
+                        return self.__encode__(rid, __expired__())
+                if name is ...: # a batch, args are (method, args, kwargs)
+                    return self.__batch__(client, rid, args, deadline)
+                method, executor = self.__method__(name)
+                if executor:
+                    future = (
+                        executor.submit(__expire__, deadline, method, args, kwargs)
+                        if deadline else executor.submit(method, *args, **kwargs)
+                    )
+                    if rid: # may be cancelled
+                        client._futures[rid] = future
+                    future.add_done_callback(
+                        partial(
+                            self.__on_done__,
+                            partial(self.__reply__, client, rid, cache, key)
+                        )
+                    )
+                    return None # replied to from __reply__
+                result = method(*args, **kwargs)
+                if rid and isinstance(result, Iterator):
+                    return self.__stream__(client, rid, result)
+                if cache is not None:
+                    return self.__memoise__(cache, key, rid, result)
             except Exception as err:
-                self._logger.exception(f"{self}: error processing request")
-                result = err
-            return encode(result)
+                result = self.__error__(err)
+            return self.__encode__(rid, result)
+        except Exception:
+            self.__on_error__("critical error processing request")
+
+    # executors ----------------------------------------------------------------
+
+    def __on_done__(self, cb, future): # executor thread
+        self._completed.append((cb, future))
+        self._completion.send()
+
+    def __on_complete__(self, *args): # watcher callback
+        try:
+            while self._completed:
+                cb, future = self._completed.popleft()
+                cb(future)
         except Exception:
             self.__on_error__("critical error processing request")
 
+    def __result__(self, future):
+        try:
+            return future.result()
+        except Exception as err:
+            return self.__error__(err)
+
+    def __reply__(self, client, rid, cache, key, future):
+        client._futures.pop(rid, None)
+        # a cancelled call is still replied to, the client drops it
+        if future.cancelled():
+            cache, result = None, None
+        else:
+            result = self.__result__(future)
+        if rid and isinstance(result, Iterator):
+            self.__stream__(client, rid, result)
+        elif not client.closed:
+            client.write(
+                self.__memoise__(cache, key, rid, result)
+                if cache is not None else self.__encode__(rid, result)
+            )
+
+    def __on_part__(self, client, rid, results, pending, future):
+        results[pending.pop(future)] = self.__result__(future)
+        if not (pending or client.closed):
+            client.write(self.__encode__(rid, results))
+
+    def __setup_executors__(self):
+        # created here, after workers are forked
+        self._executors = {
+            name: __executors__[executor](max_workers=max_workers)
+            for name, (executor, max_workers) in self._offload.items()
+        }
+        self._completion = self._loop.async_(self.__on_complete__)
+        return (self._completion,)
+
     def __on_accept__(self, *args): # watcher callback
         try:
             while True:
@@ -114,74 +473,563 @@ class Server(ServerLoop):
                 except BlockingIOError:
                     break
                 else:
-                    self._clients.append(
-                        IPPCClient(
-                            self.__on_request__,
-                            socket, self._loop, self._logger,
-                            on_close=self.__on_close__
-                        )
-                    )
+                    self.__client__(IPPCClient, socket, self._loop)
         except Exception:
             self.__on_error__("critical error accepting a connection")
 
-    def setup(self, name):
-        self._socket = ServerSocket(name)
-        return (self._loop.io(self._socket, EV_READ, self.__on_accept__),)
+    # io_uring -----------------------------------------------------------------
+
+    def __on_ring_accept__(self, socket): # ring callback
+        if isinstance(socket, Exception):
+            # only that connection is lost, the multishot accept goes on
+            self._logger.error(
+                f"{self}: error accepting a connection", exc_info=socket
+            )
+        else:
+            self.__client__(IPPCRingClient, socket, self._ring)
+
+    def __on_ring__(self, *args): # watcher callback
+        try:
+            for cb, result in self._ring.reap():
+                cb(result)
+        except Exception:
+            self.__on_error__("critical error processing completions")
+
+    def __on_submit__(self, *args): # watcher callback
+        try:
+            self._ring.submit()
+        except Exception:
+            self.__on_error__("critical error submitting requests")
+
+    def __setup_ring__(self, **kwargs):
+        if not Ring:
+            raise NotImplementedError("io_uring support is not available")
+        self._ring = Ring(**kwargs)
+        self._ring.accept(self._socket, self.__on_ring_accept__)
+        return (
+            self._loop.io(self._ring, EV_READ, self.__on_ring__),
+            self._loop.prepare(self.__on_submit__)
+        )
+
+    # --------------------------------------------------------------------------
+
+    def bind(self, name, ring=False, watermarks=None, **kwargs):
+        self._socket = ServerSocket(name, **kwargs)
+
+    def setup(self, name, ring=False, watermarks=__watermarks__, **kwargs):
+        if not self._socket: # workers inherit it
+            self.bind(name, **kwargs)
+        self._watermarks = watermarks # (high, low) or None to disable
+        self._ring = None
+        if ring: # True or a dict of Ring options
+            watchers = self.__setup_ring__(
+                **(ring if isinstance(ring, dict) else {})
+            )
+        else:
+            watchers = (
+                self._loop.io(
+                    self._socket.exclusive() if self._worker else self._socket,
+                    EV_READ, self.__on_accept__
+                ),
+            )
+        if self._offload:
+            watchers += self.__setup_executors__()
+        self._table = tuple(
+            (self._methods[name], self._executors.get(name))
+            for name in self._names
+        )
+        # what serve() may call, offloaded and cached methods are None
+        self._inline = tuple(
+            None if executor or name in self._caches else method
+            for name, (method, executor) in zip(self._names, self._table)
+        )
+        return watchers
 
     def stopping(self):
         while self._clients:
             self._clients.pop().close(False)
-        self._socket.close()
+        if self._socket:
+            self._socket.close()
+        if self._ring:
+            self._ring.close()
+        while self._executors:
+            self._executors.popitem()[1].shutdown(wait=False)
+        self._completed.clear()
+
+    def cache(self, name):
+        # the result cache of method name (stats, invalidation)
+        try:
+            return self._caches[name]
+        except KeyError:
+            raise AttributeError(f"no cache for '{name}'") from None
+
+    def pausing(self, client):
+        pass
+
+    def resuming(self, client):
+        pass
 
 
 # ------------------------------------------------------------------------------
 # Client
 
+class IPPCFuture(object):
+
+    __slots__ = ("_connection", "_rid", "_callbacks", "_result", "_done")
+
+    def __init__(self, connection, rid):
+        self._connection = connection
+        self._rid = rid
+        self._callbacks = []
+        self._result = None
+        self._done = False
+
+    def __resolve__(self, result):
+        self._result = result
+        self._done = True
+        connection, self._connection = self._connection, None
+        if connection._awaited is self:
+            connection.__unblock__()
+        callbacks, self._callbacks = self._callbacks, None
+        for cb in callbacks:
+            try:
+                cb(self)
+            except Exception:
+                connection._logger.exception(
+                    f"{connection}: error in {cb.__qualname__} callback"
+                )
+
+    def done(self):
+        return self._done
+
+    def add_done_callback(self, cb):
+        if self._done:
+            cb(self)
+        else:
+            self._callbacks.append(cb)
+
+    def result(self, timeout=None):
+        # timeout defaults to the connection's (see settimeout())
+        if not self._done:
+            self._connection.__wait__(self, timeout)
+        if isinstance(self._result, Exception):
+            raise self._result
+        return self._result
+
+    def cancel(self):
+        # the server drops the call if it did not start it yet
+        if not self._done:
+            self._connection.__cancel__(self._rid)
+            self.__resolve__(RequestError("cancelled"))
+        return self._done
+
+
+class IPPCStream(object):
+
+    def __init__(self, connection, rid):
+        self._connection = connection
+        self._rid = rid
+        self._items = deque()
+        self._end = None
+        self._done = False
+        self._consumed = 0
+
+    def __feed__(self, item, more):
+        if more:
+            self._items.append(item)
+        else:
+            self._end = item
+            self._done = True
+        if self._connection._awaited is self:
+            self._connection.__unblock__()
+
+    def __iter__(self):
+        return self
+
+    def __next__(self):
+        if not self._items:
+            if not self._done:
+                self._connection.__wait__(self)
+            if not self._items:
+                end, self._end = self._end, None
+                if isinstance(end, Exception):
+                    raise end
+                raise StopIteration
+        self._consumed += 1
+        if self._consumed >= (__window__ >> 1) and not self._done:
+            # let the server send as many items as were consumed
+            self._connection.__credit__(self._rid, self._consumed)
+            self._consumed = 0
+        return self._items.popleft()
+
+    def done(self): # next() would not block
+        return self._done or bool(self._items)
+
+    def close(self):
+        if not self._done:
+            self._done = True
+            self._items.clear()
+            connection = self._connection
+            if connection._streams.get(self._rid) is self:
+                # drop the items in flight until the server ends the stream
+                connection._streams[self._rid] = None
+                connection.__credit__(self._rid, 0)
+
+
+class IPPCStub(object):
+
+    __slots__ = ("_connection", "_header")
+
+    def __init__(self, connection, header):
+        self._connection = connection
+        self._header = header # the method, packed once
+
+    def __call__(self, *args, **kwargs):
+        return self._connection.__on_request__(self._header, args, kwargs)
+
+    def call_async(self, *args, **kwargs):
+        return self._connection.__on_async__(self._header, args, kwargs)
+
+    # None, or the index of the result in a batch
+    def notify(self, *args, **kwargs):
+        return self._connection.__on_notify__(self._header, args, kwargs)
+
+
+class IPPCOneway(IPPCStub):
+
+    __slots__ = ()
+
+    __call__ = IPPCStub.notify
+
+
 class IPPCAttribute(object):
 
-    def __init__(self, handler, name):
-        self._handler = handler
+    def __init__(self, connection, name):
+        self._connection = connection
         self._name = name
 
     def __getattr__(self, name):
-        return IPPCAttribute(self._handler, f"{self._name}.{name}")
+        if name.startswith("_"):
+            raise AttributeError(name)
+        # resolved once, then found in __dict__
+        attr = self.__dict__[name] = self._connection.__stub__(
+            f"{self._name}.{name}"
+        )
+        return attr
 
+    # not in the method table, sent by name
     def __call__(self, *args, **kwargs):
-        return self._handler(self._name, args, kwargs)
+        return self._connection.__on_request__(
+            self._connection.__header__(self._name), args, kwargs
+        )
+
+    def call_async(self, *args, **kwargs):
+        return self._connection.__on_async__(
+            self._connection.__header__(self._name), args, kwargs
+        )
+
+    def notify(self, *args, **kwargs):
+        return self._connection.__on_notify__(
+            self._connection.__header__(self._name), args, kwargs
+        )
+
+
+class IPPCBatch(object):
+
+    def __init__(self, connection):
+        self._connection = connection
+        self._calls = []
+        self._results = ()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, type, value, traceback):
+        if not type and self._calls:
+            # one frame, one reply: the list of results (or errors)
+            self._results = self._connection.__on_request__(
+                pack(...), self._calls, None
+            )
+
+    def __iter__(self):
+        return iter(self._results)
+
+    def __len__(self):
+        return len(self._results)
+
+    def __getitem__(self, index):
+        return self._results[index]
+
+    def __header__(self, method):
+        return method
+
+    def __stub__(self, name):
+        return self._connection.__stub__(name, self)
+
+    def __on_request__(self, method, args, kwargs):
+        self._calls.append((method, args, kwargs))
+        return len(self._calls) - 1 # index of the result
+
+    __on_async__ = __on_notify__ = __on_request__
+
+    def __getattr__(self, name):
+        if name.startswith("_"):
+            raise AttributeError(name)
+        # resolved once, then found in __dict__
+        attr = self.__dict__[name] = self.__stub__(name)
+        return attr
 
 
 class IPPCConnection(Overwatch):
 
-    def __init__(self, name, *args, **kwargs):
-        super().__init__(ClientSocket(name), *args, **kwargs)
+    def __init__(
+        self, name, loop, logger, on_close=None, channel=0, spin=0, timeout=0,
+        **kwargs
+    ):
+        super().__init__(
+            ClientSocket(name, **kwargs), loop, logger, on_close, spin=spin
+        )
+        self._timeout = timeout
+        self._ids = count(1)
+        self._pending = {} # request id -> callback
+        self._streams = {} # request id -> IPPCStream
+        self._awaited = None
+        # method name -> method id
+        names, oneway = self.__on_request__(pack(None), (), None)
+        # remote methods are reached as attributes, ours would shadow them
+        if (shadowed := sorted({
+            root for name in names
+            if hasattr(type(self), (root := name.split(".", 1)[0])) or
+            root in self.__dict__
+        })):
+            self.close()
+            raise ValueError(
+                f"remote names shadowed by the connection: {', '.join(shadowed)}"
+            )
+        self._table = {name: mid for mid, name in enumerate(names)}
+        self._oneway = frozenset(oneway)
+        if channel: # shared memory, channel bytes in each direction
+            self.__channel__(Channel(size=channel))
 
-    def __on_result__(self, buf):
+    def __channel__(self, channel):
         try:
-            self._result = unpack(buf)
-        except Exception as err:
-            self._result = err
+            self._socket.sendfds(b"\0", channel.fds())
+        except Exception:
+            channel.close()
+            raise
+        self.__upgrade__(channel)
+
+    def __stop__(self):
+        try:
+            super().__stop__()
         finally:
-            self.__unblock__()
+            pending, self._pending = self._pending, {}
+            for cb in pending.values():
+                if cb:
+                    cb(RequestError())
+            streams, self._streams = self._streams, {}
+            for stream in streams.values():
+                if stream:
+                    stream.__feed__(RequestError(), False)
+
+    def __on_stream__(self, rid, item, more, cb):
+        if rid in self._streams:
+            stream = self._streams[rid]
+        else:
+            if cb: # first frame, the stream is the result
+                stream = IPPCStream(self, rid)
+            else: # given up on, drop its items
+                stream = None
+                if more:
+                    self.__credit__(rid, 0)
+            self._streams[rid] = stream
+        if not more:
+            del self._streams[rid]
+        if stream:
+            stream.__feed__(item, more)
+            if cb:
+                cb(stream)
 
-    def __on_size__(self, buf):
-        self.read(size(buf), self.__on_result__)
+    def __on_reply__(self, rid, result, more, cb):
+        # more is empty for a plain reply, (True,) for a stream item and
+        # (False,) for the end of a stream
+        if more or rid in self._streams:
+            self.__on_stream__(rid, result, bool(more and more[0]), cb)
+        elif cb:
+            cb(result)
 
-    def __on_len__(self, buf):
-        self.read(buf[0], self.__on_size__)
+    def __on_result__(self, buf):
+        try:
+            rid, result, *more = unpackid(buf)
+        except Exception as err:
+            # the request id comes first
+            rid, result, more = unpack(buf), err, ()
+        cb = self._pending.pop(rid, None)
+        if more and more[0]:
+            self._pending[rid] = None # keep reading the next items
+        if self._pending:
+            self.wait()
+        self.__on_reply__(rid, result, more, cb)
 
     def wait(self):
-        self.read(1, self.__on_len__)
+        self.receive(self.__on_result__)
+
+    def __encode__(self, rid, header, args, kwargs):
+        if self._timeout: # the server drops it once expired
+            return encodecall(rid, header, args, kwargs or {}, self._timeout)
+        if kwargs:
+            return encodecall(rid, header, args, kwargs)
+        return encodecall(rid, header, args)
+
+    def __request__(self, header, args, kwargs):
+        rid = next(self._ids)
+        return rid, self.__encode__(rid, header, args, kwargs)
+
+    def __send__(self, rid, msg, cb):
+        self._pending[rid] = cb
+        self.write(msg)
+        if not self._rtasks:
+            self.wait()
+
+    def __store__(self, result):
+        self._result = result
+
+    def __resolve__(self, result):
+        self.__store__(result)
+        self.__unblock__()
 
-    def __on_request__(self, name, args, kwargs):
-        self._result = RequestError()
-        self.write(encode((name, args, kwargs)), self.wait)
-        self.__block__()
+    @staticmethod
+    def __decode__(buf):
+        # errors are returned, call() then only raises on i/o or signals
+        try:
+            return unpackid(buf)
+        except Exception as err:
+            try:
+                return unpack(buf), err # the request id comes first
+            except Exception:
+                return None, err
+
+    def __direct__(self, rid, msg):
+        # blocking call done in C, no loop involved; rid is pending until its
+        # reply is read, if call() is interrupted (a signal) the loop reads
+        # and drops it
+        self._pending[rid] = None
+        start = perf_counter_ns()
+        try:
+            try:
+                while True:
+                    _rid_, result, *more = self._socket.call(
+                        msg, self._rbuf, self.__decode__, self._budget
+                    )
+                    if _rid_ == rid or _rid_ is None: # None is undecodable
+                        break
+                    self._pending.pop(_rid_, None) # stale, read again
+            except BaseException as err:
+                if msg and not isinstance(err, OSError):
+                    self.write(msg) # interrupted while writing, the rest
+                raise
+            del self._pending[rid]
+            self.__on_reply__(rid, result, more, self.__store__)
+            if more and more[0]: # the next items are read from the loop
+                self._pending[rid] = None
+                self.wait()
+        except ConnectionError:
+            self.__on_error__("closed by peer", level=DEBUG, exc_info=False)
+            self._result = RequestError()
+        except OSError:
+            self.__on_error__("error while calling")
+            self._result = RequestError()
+        except Exception as err:
+            self._result = err
+        if self._spin:
+            self.__adapt__(perf_counter_ns() - start)
+
+    def __on_request__(self, header, args, kwargs):
+        rid, msg = self.__request__(header, args, kwargs)
+        if (
+            self._transport is self._socket and
+            not (self._timeout or self._pending or self._rtasks or self._wtasks)
+        ):
+            self.__direct__(rid, msg)
+        else:
+            self._result = unresolved = RequestError()
+            self.__send__(rid, msg, self.__resolve__)
+            try:
+                self.__block__(self._timeout)
+            finally:
+                if rid in self._pending: # given up on, drop its reply
+                    self._pending[rid] = None
+                if (
+                    self._result is unresolved and
+                    self._timeout and not self.closed
+                ):
+                    self.__cancel__(rid)
+                    self._result = __expired__()
         if isinstance(self._result, Exception):
             raise self._result
         return self._result
 
+    def __on_async__(self, header, args, kwargs):
+        rid, msg = self.__request__(header, args, kwargs)
+        future = IPPCFuture(self, rid)
+        self.__send__(rid, msg, future.__resolve__)
+        self.__flush__()
+        return future
+
+    def __on_notify__(self, header, args, kwargs):
+        # request id 0, the server does not reply
+        self.write(self.__encode__(0, header, args, kwargs))
+        self.__flush__()
+
+    def __credit__(self, rid, credits):
+        # a control notification, credits is 0 to cancel the stream
+        if not self.closed:
+            self.write(encodecall(0, self.__header__(None), (rid, credits)))
+            self.__flush__()
+
+    def __cancel__(self, rid):
+        if rid in self._pending: # drop its reply
+            self._pending[rid] = None
+        self.__credit__(rid, 0)
+
+    def __wait__(self, future, timeout=None):
+        self._awaited = future
+        if timeout is None:
+            timeout = self._timeout
+        try:
+            self.__block__(timeout)
+        finally:
+            self._awaited = None
+        if not future.done():
+            if timeout and not self.closed:
+                raise __expired__()
+            raise RequestError()
+
+    def settimeout(self, timeout):
+        # in seconds for each call, 0 to wait for as long as it takes
+        self._timeout = timeout
+
+    def __header__(self, method):
+        return pack(method)
+
+    def __stub__(self, name, target=None):
+        if target is None:
+            target = self
+        if (mid := self._table.get(name)) is not None:
+            if mid in self._oneway:
+                return IPPCOneway(target, target.__header__(mid))
+            return IPPCStub(target, target.__header__(mid))
+        return IPPCAttribute(target, name)
+
+    def batch(self):
+        return IPPCBatch(self)
+
     def __getattr__(self, name):
-        return IPPCAttribute(self.__on_request__, name)
+        if name.startswith("_"):
+            raise AttributeError(name)
+        # resolved once, then found in __dict__
+        attr = self.__dict__[name] = self.__stub__(name)
+        return attr
 
 
 class Client(ClientLoop):
@@ -190,9 +1038,9 @@ class Client(ClientLoop):
         super().__init__(**kwargs)
         self.ippc = None
 
-    def setup(self, name):
+    def setup(self, name, **kwargs):
         self.ippc = IPPCConnection(
-            name, self._loop, self._logger, on_close=self.stop
+            name, self._loop, self._logger, on_close=self.stop, **kwargs
         )
         return ()
 
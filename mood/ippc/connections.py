@@ -21,27 +21,30 @@
 
 
 from logging import ERROR, DEBUG
-from collections import deque
+from os import sched_yield
+from time import perf_counter_ns
 
 from mood.event import Loop, EVFLAG_NOSIGMASK, EV_READ, EV_WRITE, EVBREAK_ALL
 
+from . import sockets
+
 
 # ------------------------------------------------------------------------------
 # Connection
 
-class Connection(object):
+class Connection(sockets.Connection):
+
+    # the data path (buffers, framing, queues and watcher callbacks) lives in
+    # sockets.Connection, only complete frames come up to python
+
+    _hangup = None
 
     def __setup__(self, socket, loop, logger, on_close=None):
-        self._socket = socket
+        self._socket = self._transport = socket
+        self._loop = loop
         self._logger = logger
         self._on_close = on_close
-        self._closing = False
-        # writer
-        self._wtasks = deque()
         self._writer = loop.io(socket, EV_WRITE, self.__on_write__)
-        # reader
-        self._rbuf = bytearray()
-        self._rtasks = deque()
         self._reader = loop.io(socket, EV_READ, self.__on_read__)
         self._reader.start()
 
@@ -59,105 +62,64 @@ class Connection(object):
         finally:
             self.close() # close on error
 
-    def __run__(self, cb, *args):
-        try:
-            cb(*args)
-        except Exception:
-            self.__on_error__(f"error in {cb.__qualname__} callback")
-
 
     # close --------------------------------------------------------------------
 
-    @property
-    def closed(self):
-        return self._socket.closed
-
     def __stop__(self):
-        self._reader.stop()
-        self._rtasks.clear()
-        self._rbuf.clear()
-        self._writer.stop()
-        self._wtasks.clear()
-        self._socket.close()
+        if self._hangup:
+            self._hangup.stop()
+            self._transport.close()
+        super().__stop__()
 
     def __cleanup__(self):
-        self._reader = self._writer = None # break cycles
-
-    def close(self, notify=True):
-        if not self.closed and not self._closing:
-            self._closing = True
-            self._logger.debug(f"{self}: closing...")
-            try:
-                self.__stop__()
-            finally:
-                self.__cleanup__()
-                if self._on_close:
-                    cb, self._on_close = self._on_close, None
-                    if notify:
-                        self.__run__(cb, self)
-                self._logger.debug(f"{self}: closed")
-                self._closing = False
-
-
-    # read ---------------------------------------------------------------------
-
-    def __consume__(self, size, cb, args):
-        if len(self._rbuf) >= size:
-            buf, self._rbuf = self._rbuf[:size], self._rbuf[size:]
-            self.__run__(cb, buf, *args)
-            return True
-        return False
-
-    def __on_read__(self, *args): # watcher callback
+        self._hangup = None # break cycles
+        super().__cleanup__()
+
+
+    # channel ------------------------------------------------------------------
+
+    def __on_hangup__(self, *args): # watcher callback
         try:
-            closed = self._socket.read(self._rbuf)
+            closed = self._socket.read(bytearray())
         except BlockingIOError:
            pass
         except Exception:
             self.__on_error__("error while reading data")
         else:
-            while self._rtasks:
-                task = self._rtasks.popleft()
-                if not self.__consume__(*task):
-                    self._rtasks.appendleft(task)
-                    break
             if closed:
-                # remote end closed the connection
                 self.__on_error__("closed by peer", level=DEBUG, exc_info=False)
 
-    def read(self, size, cb, *args):
-        if size and (self._rtasks or not self.__consume__(size, cb, args)):
-            if self.closed:
-                raise ConnectionError(f"{self}: already closed.")
-            self._rtasks.append((size, cb, args))
+    def __upgrade__(self, channel):
+        # data goes through the channel from now on, the socket is only
+        # watched for the peer closing the connection
+        self._reader.stop()
+        self._writer.stop()
+        self._transport = channel
+        self._writer = self._loop.io(
+            channel.wfileno(), EV_READ, self.__on_write__
+        )
+        self._reader = self._loop.io(channel, EV_READ, self.__on_read__)
+        if not self._paused:
+            self._reader.start()
+        self._hangup = self._loop.io(self._socket, EV_READ, self.__on_hangup__)
+        self._hangup.start()
 
 
-    # write --------------------------------------------------------------------
+# ------------------------------------------------------------------------------
+# RingConnection
 
-    def __on_write__(self, *args): # watcher callback
-        buf, cb, args = task = self._wtasks.popleft()
-        try:
-            self._socket.write(buf)
-        except BlockingIOError:
-            self._wtasks.appendleft(task)
-        except Exception:
-            self.__on_error__("error while writing data")
-        else:
-            if buf:
-                self._wtasks.appendleft(task)
-            else:
-                if not self._wtasks:
-                    self._writer.stop()
-                if cb:
-                    self.__run__(cb, *args)
+class RingConnection(Connection):
 
-    def write(self, buf, cb=None, args=()):
-        if buf:
-            if self.closed:
-                raise ConnectionError(f"{self}: already closed.")
-            self._wtasks.append((buf, cb, args))
-            if not self._writer.active:
-                self._writer.start()
+    def __setup__(self, socket, ring, logger, on_close=None):
+        self._socket = self._transport = socket
+        self._ring = ring # sends go through the ring too, see __on_send__
+        self._logger = logger
+        self._on_close = on_close
+        self._ring.recv(socket, self._rbuf, self.__on_recv__)
+
+    def __upgrade__(self, channel):
+        channel.close()
+        raise NotImplementedError("channels are not supported over io_uring")
 
 
 # ------------------------------------------------------------------------------
@@ -165,27 +127,102 @@ class Connection(object):
 
 class Overwatch(Connection):
 
-    def __setup__(self, socket, loop, logger, on_close=None):
+    _overhang = None
+
+    def __setup__(self, socket, loop, logger, on_close=None, spin=0):
         self._loop = Loop(flags=EVFLAG_NOSIGMASK)
         super().__setup__(socket, self._loop, logger, on_close=on_close)
         # overwatch
         self._overwatch = loop.io(socket, EV_READ, self.__on_read__)
         self._overwatch.start()
+        # writes issued outside of __block__ are flushed from the main loop
+        self._flusher = loop.io(socket, EV_WRITE, self.__on_flush__)
+        # busy-poll (spin is the max budget in µs, 0 to disable)
+        self._spin = self._budget = spin * 1000
+        self._latency = 0
+        self._blocked = False
 
     def __stop__(self):
         self._loop.stop(EVBREAK_ALL)
         self._overwatch.stop()
+        self._flusher.stop()
+        if self._overhang:
+            self._overhang.stop()
         super().__stop__()
 
     def __cleanup__(self):
-        self._overwatch = None # break cycles
+        self._overwatch = self._flusher = self._overhang = None # break cycles
         super().__cleanup__()
 
-    def __block__(self):
+    def __upgrade__(self, channel):
+        super().__upgrade__(channel)
+        loop = self._overwatch.loop
         self._overwatch.stop()
-        self._loop.start()
+        self._overwatch = loop.io(channel, EV_READ, self.__on_read__)
+        self._overwatch.start()
+        self._flusher.stop()
+        self._flusher = loop.io(channel.wfileno(), EV_READ, self.__on_flush__)
+        self._overhang = loop.io(self._socket, EV_READ, self.__on_hangup__)
+        self._overhang.start()
+
+    def __on_flush__(self, *args): # watcher callback
+        self.__on_write__()
+        if not (self.closed or self._wtasks):
+            self._flusher.stop()
+
+    def __flush__(self):
+        self.__on_write__()
+        if self._wtasks and not self.closed:
+            self._flusher.start()
+
+    def __poll__(self, deadline):
+        while self._blocked and not self.closed:
+            if self._wtasks:
+                self.__on_write__()
+            else:
+                self.__on_read__()
+            if not self._blocked or perf_counter_ns() > deadline:
+                break
+            sched_yield() # drops the GIL, other threads keep running
+
+    def __adapt__(self, elapsed):
+        # only spin when replies usually arrive within the budget, the
+        # latency keeps being tracked while blocking so that we come back
+        self._latency += (elapsed - self._latency) >> 3
+        self._budget = (
+            min(self._spin, self._latency << 1)
+            if self._latency < self._spin else 0
+        )
+
+    def __on_timeout__(self, *args): # watcher callback
+        self.__unblock__()
+
+    def __block__(self, timeout=0):
+        # timeout is in seconds, 0 to block until __unblock__
+        if self._wtasks: # queued while draining
+            self.__push__()
+        self._blocked = True
+        start = perf_counter_ns()
+        if self._budget:
+            self.__poll__(start + self._budget)
+        if self._blocked and not self.closed:
+            self._overwatch.stop()
+            if timeout:
+                timer = self._loop.timer(timeout, 0.0, self.__on_timeout__)
+                timer.start()
+                try:
+                    self._loop.start()
+                finally:
+                    timer.stop()
+            else:
+                self._loop.start()
+        self._blocked = False
+        if self._spin:
+            self.__adapt__(perf_counter_ns() - start)
 
     def __unblock__(self):
+        self._blocked = False
         self._loop.stop(EVBREAK_ALL)
-        self._overwatch.start()
+        if not self.closed:
+            self._overwatch.start()
 
@@ -23,8 +23,15 @@
 import builtins
 from logging import getLogger
 from collections import deque
-from os import getpid
-from signal import pthread_sigmask, SIG_UNBLOCK, SIGINT, SIGTERM
+from os import (
+    fork, getpid, kill, waitpid, _exit,
+    WEXITSTATUS, WIFSIGNALED, WNOHANG, WTERMSIG
+)
+from signal import (
+    pthread_sigmask, sigwaitinfo, SIG_BLOCK, SIG_SETMASK, SIG_UNBLOCK,
+    SIGCHLD, SIGINT, SIGTERM
+)
+from time import monotonic, sleep
 
 from mood.event import (
     loop, Loop, EVFLAG_AUTO, EVFLAG_NOSIGMASK, EVBREAK_ALL, EV_MAXPRI
@@ -65,7 +72,8 @@ def watcher(wtype, *wargs, **wkwargs):
 class __SignalLoop__(object):
 
     def __init__(self, logger, flags=EVFLAG_AUTO):
-        self._loop = self.__ctor__(flags=(flags | EVFLAG_NOSIGMASK))
+        self._flags = flags | EVFLAG_NOSIGMASK
+        self._loop = self.__ctor__(flags=self._flags)
         self._logger = logger
         self._watchers = deque()
         self._stopping = False
@@ -182,6 +190,80 @@ class ServerLoop(__BaseLoop__):
 
     __ctor__ = loop
 
+    def __init__(self, **kwargs):
+        super().__init__(**kwargs)
+        self._worker = False
+
+    # workers ------------------------------------------------------------------
+
+    def __spawn__(self, mask, *args, **kwargs):
+        if (pid := fork()):
+            return pid
+        # worker
+        status = 0
+        try:
+            pthread_sigmask(SIG_SETMASK, mask)
+            self._worker = True
+            self._pid = getpid()
+            # the inherited default loop shares its kernel state with the
+            # parent and the other workers, use a private one
+            self._loop = Loop(flags=self._flags)
+            super().start(*args, **kwargs)
+        except BaseException:
+            self._logger.exception(f"{self}: worker error")
+            status = 1
+        finally:
+            _exit(status)
+
+    def __supervise__(self, workers, *args, **kwargs):
+        signals = {SIGINT, SIGTERM}
+        mask = pthread_sigmask(SIG_BLOCK, signals | {SIGCHLD})
+        try:
+            self._logger.info(f"{self}: starting {workers} workers...")
+            self.bind(*args, **kwargs)
+            pids = {
+                self.__spawn__(mask, *args, **kwargs): monotonic()
+                for _ in range(workers)
+            }
+            while pids:
+                if sigwaitinfo(signals | {SIGCHLD}).si_signo != SIGCHLD:
+                    if not self._stopping:
+                        self._stopping = True
+                        self._logger.info(f"{self}: stopping workers...")
+                        for pid in pids:
+                            kill(pid, SIGTERM)
+                    continue
+                while pids and (status := waitpid(-1, WNOHANG))[0]:
+                    pid, code = status
+                    code = -WTERMSIG(code) if WIFSIGNALED(code) else WEXITSTATUS(code)
+                    started = pids.pop(pid, None)
+                    if not self._stopping:
+                        self._logger.error(
+                            f"{self}: worker {pid} exited ({code}) -> restarting"
+                        )
+                        # do not spin on a worker that dies right away
+                        if started and (monotonic() - started) < 1.0:
+                            sleep(1.0)
+                        pids[self.__spawn__(mask, *args, **kwargs)] = monotonic()
+            self._logger.info(f"{self}: workers stopped")
+        finally:
+            self._stopping = False
+            try:
+                self.stopping()
+            finally:
+                pthread_sigmask(SIG_SETMASK, mask)
+
+    # --------------------------------------------------------------------------
+
+    def start(self, *args, workers=0, **kwargs):
+        if workers:
+            self.__supervise__(workers, *args, **kwargs)
+        else:
+            super().start(*args, **kwargs)
+
+    def bind(self, *args, **kwargs):
+        pass
+
 
 # ------------------------------------------------------------------------------
 # ClientLoop
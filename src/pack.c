@@ -46,6 +46,25 @@ typedef struct {
 } module_state;
 
 
+/* PyObject_Vectorcall is public from 3.9 */
+#if PY_VERSION_HEX < 0x03090000
+#define PyObject_Vectorcall _PyObject_Vectorcall
+#endif
+
+
+/* args of a served call, decoded onto the stack (see serve()) */
+#define SERVE_NARGS 16
+
+typedef struct {
+    PyObject *small[1 + SERVE_NARGS];
+    PyObject **stack; // stack[0] is left free for the callee
+    Py_ssize_t size;
+    Py_ssize_t len;
+    Py_ssize_t nargs;
+    PyObject *kwnames;
+} serve_call;
+
+
 /* for use with Py_EnterRecursiveCall */
 #define _While_(a, n) " while " #a " a " n
 #define _Packing_(n) _While_(packing, n)
@@ -219,6 +238,19 @@ __pack_buffers__(PyByteArrayObject *self, uint8_t type,
 }
 
 
+static inline int
+__pack_raw__(PyByteArrayObject *self, const void *_buffer, size_t _size)
+{
+    size_t size = _size;
+
+    __PACK_BEGIN__
+
+    memcpy((self->ob_bytes + start), _buffer, _size);
+
+    __PACK_END__
+}
+
+
 /* -------------------------------------------------------------------------- */
 
 static PyObject *
@@ -257,6 +289,13 @@ __pack_buffers(PyObject *msg, uint8_t type,
 }
 
 
+static int
+__pack_raw(PyObject *msg, const void *_buffer, size_t _size)
+{
+    return __pack_raw__((PyByteArrayObject *)msg, _buffer, _size);
+}
+
+
 /* -------------------------------------------------------------------------- */
 
 static inline uint8_t
@@ -741,6 +780,44 @@ __pack_encode(PyObject *msg, PyObject *obj)
 }
 
 
+// the id is packed in front of obj, unpack() on such a msg returns the id
+static PyObject *
+__pack_encodeid(PyObject *msg, int64_t id, PyObject *obj, PyObject *more)
+{
+    return (
+            __pack_int__(msg, id) ||
+            __pack_object(msg, obj) ||
+            (more && __pack_object(msg, more))
+           ) ? NULL : __pack_encode__(msg);
+}
+
+
+// header is already packed (see pack()), kwargs and more are optional
+static PyObject *
+__pack_encodecall(PyObject *msg, int64_t id, Py_buffer *header,
+                  PyObject *args, PyObject *kwargs, PyObject *more)
+{
+    return (
+            __pack_int__(msg, id) ||
+            __pack_raw(msg, header->buf, header->len) ||
+            __pack_object(msg, args) ||
+            (kwargs && __pack_object(msg, kwargs)) ||
+            (more && __pack_object(msg, more))
+           ) ? NULL : __pack_encode__(msg);
+}
+
+
+// data is already packed (a cached result)
+static PyObject *
+__pack_encodedata(PyObject *msg, int64_t id, Py_buffer *data)
+{
+    return (
+            __pack_int__(msg, id) ||
+            __pack_raw(msg, data->buf, data->len)
+           ) ? NULL : __pack_encode__(msg);
+}
+
+
 /* --------------------------------------------------------------------------
    unpack
    -------------------------------------------------------------------------- */
@@ -1392,6 +1469,36 @@ __unpack_msg(Py_buffer *msg, Py_ssize_t *off)
 }
 
 
+// all the objects in msg, the id first
+static PyObject *
+__unpackid(Py_buffer *msg)
+{
+    PyObject *result = NULL, *item = NULL;
+    Py_ssize_t off = 0, len = 0;
+
+    if (!msg->len) {
+        return PyErr_Format(PyExc_ValueError, "empty msg");
+    }
+    if ((result = PyTuple_New(4))) {
+        while (off < msg->len) {
+            if (((len == PyTuple_GET_SIZE(result)) &&
+                 _PyTuple_Resize(&result, (len << 1))) ||
+                !(item = __unpack_msg(msg, &off))) {
+                break;
+            }
+            PyTuple_SET_ITEM(result, len++, item);
+        }
+        if (PyErr_Occurred()) {
+            Py_CLEAR(result);
+        }
+        else if (len < PyTuple_GET_SIZE(result)) {
+            _PyTuple_Resize(&result, len);
+        }
+    }
+    return result;
+}
+
+
 static PyObject *
 __size(Py_buffer *msg)
 {
@@ -1419,6 +1526,346 @@ __size(Py_buffer *msg)
 }
 
 
+/* --------------------------------------------------------------------------
+   serve
+   -------------------------------------------------------------------------- */
+
+// the method (borrowed) for the id at off in msg, NULL if it is not the index
+// of a callable in table (a name, a control message, an offloaded method)
+static inline PyObject *
+__serve_method(Py_buffer *msg, Py_ssize_t *off, PyObject *table)
+{
+    PyObject *mid = NULL, *method = NULL;
+    Py_ssize_t idx = -1;
+
+    if ((mid = __unpack_msg(msg, off))) {
+        if (PyLong_CheckExact(mid) &&
+            ((idx = PyLong_AsSsize_t(mid)) >= 0) &&
+            (idx < PyTuple_GET_SIZE(table)) &&
+            ((method = PyTuple_GET_ITEM(table, idx)) == Py_None)) {
+            method = NULL;
+        }
+        else if ((idx == -1) && PyErr_Occurred()) {
+            PyErr_Clear(); // out of range, left to the caller
+        }
+        Py_DECREF(mid);
+    }
+    return method;
+}
+
+
+// the size of the container of type at off in msg, -2 if it is of another type
+static inline Py_ssize_t
+__serve_size(Py_buffer *msg, Py_ssize_t *off, uint8_t type)
+{
+    const char *buffer = NULL;
+    Py_ssize_t size = -1;
+
+    switch (__unpack_type(msg, off) ^ type) {
+        case 1:
+            size = __unpack_size__(msg, off, 1);
+            break;
+        case 2:
+            size = __unpack_size__(msg, off, 2);
+            break;
+        case 4:
+            size = __unpack_size__(msg, off, 4);
+            break;
+        case 8:
+            size = __unpack_size__(msg, off, 8);
+            break;
+        default:
+            return PyErr_Occurred() ? -1 : -2;
+    }
+    if (size < 0) {
+        if (!PyErr_Occurred()) {
+            PyErr_SetString(PyExc_ValueError, "invalid size");
+        }
+        return -1;
+    }
+    return size;
+}
+
+
+// move off past the object at off in msg, without unpacking it
+static int
+__serve_skip(Py_buffer *msg, Py_ssize_t *off)
+{
+    Py_ssize_t poff = *off, size = 0, i;
+    uint8_t type = TYPE_INVALID;
+    int res = 0;
+
+    switch ((type = __unpack_type(msg, off))) {
+        case TYPE_INVALID:
+            if (!PyErr_Occurred()) {
+                PyErr_Format(PyExc_TypeError,
+                             "invalid type: '0x%02x'", type);
+            }
+            return -1;
+        case TYPE_INT1:
+        case TYPE_INT2:
+        case TYPE_INT4:
+        case TYPE_INT8:
+            return __unpack_buffer(msg, off, type) ? 0 : -1;
+        case TYPE_UINT:
+        case TYPE_FLOAT:
+            return __unpack_buffer(msg, off, 8) ? 0 : -1;
+        case TYPE_COMPLEX:
+            return __unpack_buffer(msg, off, 16) ? 0 : -1;
+        case TYPE_NONE:
+        case TYPE_TRUE:
+        case TYPE_FALSE:
+            return 0;
+        default:
+            break;
+    }
+    *off = poff; // sized, read again with its size
+    if ((size = __serve_size(msg, off, (type & 0xf0))) < 0) {
+        if (size == -2) {
+            PyErr_Format(PyExc_TypeError, "unknown type: '0x%02x'", type);
+        }
+        return -1;
+    }
+    switch (type & 0xf0) {
+        case TYPE_DICT:
+            if (size > (PY_SSIZE_T_MAX >> 1)) {
+                PyErr_SetString(PyExc_EOFError, "Ran out of input");
+                return -1;
+            }
+            size <<= 1;
+            // fall through
+        case TYPE_TUPLE:
+        case TYPE_LIST:
+        case TYPE_SET:
+        case TYPE_FROZENSET:
+            if (Py_EnterRecursiveCall(" while skipping")) {
+                return -1;
+            }
+            for (i = 0; i < size; ++i) {
+                if ((res = __serve_skip(msg, off))) {
+                    break;
+                }
+            }
+            Py_LeaveRecursiveCall();
+            return res;
+        case TYPE_STR:
+        case TYPE_BYTES:
+        case TYPE_BYTEARRAY:
+        case TYPE_CLASS:
+        case TYPE_SINGLETON:
+        case TYPE_INSTANCE:
+            return __unpack_buffer(msg, off, size) ? 0 : -1;
+        default:
+            PyErr_Format(PyExc_TypeError, "unknown type: '0x%02x'", type);
+            return -1;
+    }
+}
+
+
+static inline void
+__serve_call_init(serve_call *call)
+{
+    call->stack = call->small;
+    call->size = 1 + SERVE_NARGS;
+    call->len = 1;
+    call->nargs = 0;
+    call->kwnames = NULL;
+}
+
+
+static inline void
+__serve_call_clear(serve_call *call)
+{
+    while (call->len > 1) {
+        Py_DECREF(call->stack[--call->len]);
+    }
+    if (call->stack != call->small) {
+        PyMem_Free(call->stack);
+    }
+    Py_CLEAR(call->kwnames);
+}
+
+
+static inline int
+__serve_call_reserve(serve_call *call, Py_ssize_t size)
+{
+    PyObject **stack = NULL;
+
+    if (size > call->size) {
+        if (!(stack = PyMem_New(PyObject *, size))) {
+            PyErr_NoMemory();
+            return -1;
+        }
+        memcpy(stack, call->stack, (call->len * sizeof(PyObject *)));
+        if (call->stack != call->small) {
+            PyMem_Free(call->stack);
+        }
+        call->stack = stack;
+        call->size = size;
+    }
+    return 0;
+}
+
+
+static inline int
+__serve_call_push(serve_call *call, Py_buffer *msg, Py_ssize_t *off)
+{
+    PyObject *item = NULL;
+
+    if (!(item = __unpack_msg(msg, off))) {
+        return -1;
+    }
+    call->stack[call->len++] = item; // steals ref
+    return 0;
+}
+
+
+// args[, kwargs] at off in msg: the positional args followed by the values of
+// kwargs on the stack, their keys in kwnames; returns 1 if they are not a
+// tuple and an optional dict of str keys (left to the caller)
+static int
+__serve_call_decode(serve_call *call, Py_buffer *msg, Py_ssize_t *off)
+{
+    PyObject *key = NULL;
+    Py_ssize_t nkw = 0, i;
+
+    if ((call->nargs = __serve_size(msg, off, TYPE_TUPLE)) < 0) {
+        return (call->nargs == -1) ? -1 : 1;
+    }
+    if (__serve_call_reserve(call, (1 + call->nargs))) {
+        return -1;
+    }
+    for (i = 0; i < call->nargs; ++i) {
+        if (__serve_call_push(call, msg, off)) {
+            return -1;
+        }
+    }
+    if (*off < msg->len) {
+        if ((nkw = __serve_size(msg, off, TYPE_DICT)) < 0) {
+            return (nkw == -1) ? -1 : 1;
+        }
+        if (nkw) {
+            if (__serve_call_reserve(call, (1 + call->nargs + nkw)) ||
+                !(call->kwnames = PyTuple_New(nkw))) {
+                return -1;
+            }
+            for (i = 0; i < nkw; ++i) {
+                if (!(key = __unpack_msg(msg, off))) {
+                    return -1;
+                }
+                PyTuple_SET_ITEM(call->kwnames, i, key); // steals ref
+                if (!PyUnicode_CheckExact(key)) {
+                    return 1;
+                }
+                if (__serve_call_push(call, msg, off)) {
+                    return -1;
+                }
+            }
+        }
+    }
+    return (*off < msg->len) ? 1 : 0;
+}
+
+
+// decode, call and encode the reply in one go, for requests whose method is
+// an index in table; anything else is NotImplemented and left to the caller
+// (nothing was called then), a notification is None, and an iterator result
+// is returned as (rid, iterator) to be streamed
+static PyObject *
+__serve(Py_buffer *msg, PyObject *table)
+{
+    PyObject *rid = NULL, *method = NULL, *result = NULL, *reply = NULL;
+    PyObject *data = NULL;
+    serve_call call;
+    Py_ssize_t off = 0;
+    long long id = 0;
+    int res = 0;
+
+    if (!msg->len) {
+        return PyErr_Format(PyExc_ValueError, "empty msg");
+    }
+    if (!(rid = __unpack_msg(msg, &off))) {
+        return NULL;
+    }
+    if (!PyLong_CheckExact(rid)) {
+        Py_DECREF(rid);
+        Py_RETURN_NOTIMPLEMENTED;
+    }
+    if (((id = PyLong_AsLongLong(rid)) == -1) && PyErr_Occurred()) {
+        Py_DECREF(rid);
+        return NULL;
+    }
+    if (!(method = __serve_method(msg, &off, table))) {
+        Py_DECREF(rid);
+        if (PyErr_Occurred()) {
+            return NULL;
+        }
+        Py_RETURN_NOTIMPLEMENTED;
+    }
+    __serve_call_init(&call);
+    if ((res = __serve_call_decode(&call, msg, &off))) {
+        __serve_call_clear(&call);
+        Py_DECREF(rid);
+        if (res == -1) {
+            return NULL;
+        }
+        Py_RETURN_NOTIMPLEMENTED;
+    }
+    // the args are passed as they were decoded, no tuple nor dict involved
+    result = PyObject_Vectorcall(
+        method, (call.stack + 1),
+        (call.nargs | PY_VECTORCALL_ARGUMENTS_OFFSET), call.kwnames
+    );
+    __serve_call_clear(&call);
+    if (result) {
+        if (!id) {
+            reply = __Py_INCREF(Py_None);
+        }
+        else if (PyIter_Check(result)) {
+            reply = PyTuple_Pack(2, rid, result);
+        }
+        else if ((data = __new_msg())) {
+            reply = __pack_encodeid(data, id, result, NULL);
+            Py_DECREF(data);
+        }
+        Py_DECREF(result);
+    }
+    Py_DECREF(rid);
+    return reply;
+}
+
+
+// (id, method, key) for the request in msg, key being its args[, kwargs] as
+// they were packed, an empty kwargs and what follows (a timeout) left out
+static PyObject *
+__servekey(Py_buffer *msg)
+{
+    PyObject *result = NULL, *rid = NULL, *method = NULL, *key = NULL;
+    const uint8_t *buf = msg->buf;
+    Py_ssize_t start = 0, end = 0;
+
+    if (!msg->len) {
+        return PyErr_Format(PyExc_ValueError, "empty msg");
+    }
+    if ((rid = __unpack_msg(msg, &start)) &&
+        (method = __unpack_msg(msg, &start))) {
+        end = start;
+        if (!__serve_skip(msg, &end) &&
+            ((end == msg->len) ||
+             (((end + 1) < msg->len) &&
+              (buf[end] == (TYPE_DICT | 1)) && !buf[end + 1]) ||
+             !__serve_skip(msg, &end)) &&
+            (key = PyBytes_FromStringAndSize((msg->buf + start), (end - start)))) {
+            result = PyTuple_Pack(3, rid, method, key);
+            Py_DECREF(key);
+        }
+    }
+    Py_XDECREF(method);
+    Py_XDECREF(rid);
+    return result;
+}
+
+
 /* --------------------------------------------------------------------------
    module
    -------------------------------------------------------------------------- */
@@ -1464,6 +1911,62 @@ pack_encode(PyObject *module, PyObject *obj)
 }
 
 
+/* pack.encodeid() */
+static PyObject *
+pack_encodeid(PyObject *module, PyObject *args)
+{
+    PyObject *result = NULL, *msg = NULL, *obj = NULL, *more = NULL;
+    long long id;
+
+    if (PyArg_ParseTuple(args, "LO|O:encodeid", &id, &obj, &more) &&
+        (msg = __new_msg())) {
+        result = __pack_encodeid(msg, id, obj, more);
+        Py_DECREF(msg);
+    }
+    return result;
+}
+
+
+/* pack.encodecall() */
+static PyObject *
+pack_encodecall(PyObject *module, PyObject *args)
+{
+    PyObject *result = NULL, *msg = NULL, *cargs = NULL, *kwargs = NULL;
+    PyObject *more = NULL;
+    long long id;
+    Py_buffer header;
+
+    if (PyArg_ParseTuple(args, "Ly*O|OO:encodecall",
+                         &id, &header, &cargs, &kwargs, &more)) {
+        if ((msg = __new_msg())) {
+            result = __pack_encodecall(msg, id, &header, cargs, kwargs, more);
+            Py_DECREF(msg);
+        }
+        PyBuffer_Release(&header);
+    }
+    return result;
+}
+
+
+/* pack.encodedata() */
+static PyObject *
+pack_encodedata(PyObject *module, PyObject *args)
+{
+    PyObject *result = NULL, *msg = NULL;
+    long long id;
+    Py_buffer data;
+
+    if (PyArg_ParseTuple(args, "Ly*:encodedata", &id, &data)) {
+        if ((msg = __new_msg())) {
+            result = __pack_encodedata(msg, id, &data);
+            Py_DECREF(msg);
+        }
+        PyBuffer_Release(&data);
+    }
+    return result;
+}
+
+
 /* pack.unpack() */
 static PyObject *
 pack_unpack(PyObject *module, PyObject *args)
@@ -1480,6 +1983,21 @@ pack_unpack(PyObject *module, PyObject *args)
 }
 
 
+/* pack.unpackid() */
+static PyObject *
+pack_unpackid(PyObject *module, PyObject *args)
+{
+    PyObject *result = NULL;
+    Py_buffer msg;
+
+    if (PyArg_ParseTuple(args, "y*:unpackid", &msg)) {
+        result = __unpackid(&msg);
+        PyBuffer_Release(&msg);
+    }
+    return result;
+}
+
+
 /* pack.size() */
 static PyObject *
 pack_size(PyObject *module, PyObject *args)
@@ -1495,6 +2013,36 @@ pack_size(PyObject *module, PyObject *args)
 }
 
 
+/* pack.serve() */
+static PyObject *
+pack_serve(PyObject *module, PyObject *args)
+{
+    PyObject *result = NULL, *table = NULL;
+    Py_buffer msg;
+
+    if (PyArg_ParseTuple(args, "y*O!:serve", &msg, &PyTuple_Type, &table)) {
+        result = __serve(&msg, table);
+        PyBuffer_Release(&msg);
+    }
+    return result;
+}
+
+
+/* pack.servekey() */
+static PyObject *
+pack_servekey(PyObject *module, PyObject *args)
+{
+    PyObject *result = NULL;
+    Py_buffer msg;
+
+    if (PyArg_ParseTuple(args, "y*:servekey", &msg)) {
+        result = __servekey(&msg);
+        PyBuffer_Release(&msg);
+    }
+    return result;
+}
+
+
 /* pack_def.m_methods */
 static PyMethodDef pack_m_methods[] = {
     {"register", (PyCFunction)pack_register, METH_O,       "register(obj)"},
@@ -1502,6 +2050,18 @@ static PyMethodDef pack_m_methods[] = {
     {"encode",   (PyCFunction)pack_encode,   METH_O,       "encode(obj) -> msg"},
     {"unpack",   (PyCFunction)pack_unpack,   METH_VARARGS, "unpack(msg) -> obj"},
     {"size",     (PyCFunction)pack_size,     METH_VARARGS, "size(msg) -> int"},
+    {"encodeid", (PyCFunction)pack_encodeid, METH_VARARGS,
+     "encodeid(id, obj[, more]) -> msg"},
+    {"encodecall", (PyCFunction)pack_encodecall, METH_VARARGS,
+     "encodecall(id, header, args[, kwargs[, more]]) -> msg"},
+    {"encodedata", (PyCFunction)pack_encodedata, METH_VARARGS,
+     "encodedata(id, data) -> msg"},
+    {"unpackid", (PyCFunction)pack_unpackid, METH_VARARGS,
+     "unpackid(msg) -> (id, obj, ...)"},
+    {"serve",    (PyCFunction)pack_serve,    METH_VARARGS,
+     "serve(msg, table) -> reply"},
+    {"servekey", (PyCFunction)pack_servekey, METH_VARARGS,
+     "servekey(msg) -> (id, method, key)"},
     {NULL} /* Sentinel */
 };
 
@@ -22,6 +22,7 @@
 
 #define PY_SSIZE_T_CLEAN
 #include "Python.h"
+#include "structmember.h"
 
 
 #include "helpers/helpers.h"
@@ -29,39 +30,149 @@
 
 #include <stddef.h>
 
+#include <fcntl.h>
+#include <linux/errqueue.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/un.h>
 
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+
+#if defined(IORING_RECV_MULTISHOT) && defined(__NR_io_uring_setup)
+#define HAVE_IO_URING 1
+#endif
+
 
 #define SOCK_TYPE (SOCK_STREAM | SOCK_CLOEXEC)
 #define SOCK_FLAGS (SOCK_CLOEXEC | SOCK_NONBLOCK)
 
 
+/* adaptive buffers grow after that many consecutive oversized frames */
+#define SOCK_ADAPT_HITS 4
+
+/* transfers of at least that many bytes run without the GIL, below that the
+   switch costs more than the syscall itself */
+#define SOCK_NOGIL 16384
+
+#define SOCK_BEGIN_ALLOW_THREADS(c) \
+    { PyThreadState *_save = (c) ? PyEval_SaveThread() : NULL;
+
+#define SOCK_END_ALLOW_THREADS \
+    if (_save) { PyEval_RestoreThread(_save); } }
+
+/* max number of descriptors passed along with a single message */
+#define SOCK_MAXFDS 8
+
+/* marker byte of a frame handed over in a memfd (never a valid frame header) */
+#define SOCK_MEMFD_FRAME 0xff
+#define SOCK_MEMFD_SEALS \
+    (F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL)
+
+
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY) && defined(SO_EE_ORIGIN_ZEROCOPY)
+#define HAVE_ZEROCOPY 1
+#endif
+
+
+/* PyObject_Vectorcall is public from 3.9 */
+#if PY_VERSION_HEX < 0x03090000
+#define PyObject_Vectorcall _PyObject_Vectorcall
+#endif
+
+
 static int
-getsocksize(int fd)
+getsocksize(int fd, int optname)
 {
     int result;
     socklen_t resultlen = sizeof(result);
 
-    if (getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &result, &resultlen)) {
+    if (getsockopt(fd, SOL_SOCKET, optname, &result, &resultlen)) {
         return -1;
     }
     return ((result / 2) & ~7);
 }
 
 
+static int
+setsocksize(int fd, int optname, int size)
+{
+    if (size > 0) {
+        return setsockopt(fd, SOL_SOCKET, optname, &size, sizeof(size));
+    }
+    return 0;
+}
+
+
+/* the pending exception, as a value */
+static inline PyObject *
+__exception(void)
+{
+    PyObject *type = NULL, *value = NULL, *traceback = NULL;
+
+    PyErr_Fetch(&type, &value, &traceback);
+    PyErr_NormalizeException(&type, &value, &traceback);
+    if (value && traceback) {
+        PyException_SetTraceback(value, traceback);
+    }
+    Py_XDECREF(traceback);
+    Py_XDECREF(type);
+    return value;
+}
+
+
 /* --------------------------------------------------------------------------
    Abstract
    -------------------------------------------------------------------------- */
 
+/* a buffer sent with MSG_ZEROCOPY, waiting for completion of send id */
+typedef struct {
+    uint32_t id;
+    PyObject *buf;
+} ZCBuffer;
+
+
 /* Abstract */
 typedef struct {
     PyObject_HEAD
     PyObject *name;
     int fd;
     int size;
+    int rsize;
+    int sndbuf;
+    int rcvbuf;
+    int maxbuf;
+    int whits;
+    int rhits;
+    int family;
+    int nodelay;
+    int quickack;
+    int keepalive;
+    int zerocopy;
+    uint32_t zcid;
+    ZCBuffer *zcbufs;
+    Py_ssize_t zclen;
+    Py_ssize_t zcalloc;
+    int memfd;
+    int *fds;
+    Py_ssize_t nfds;
+    Py_ssize_t fdsalloc;
+    int epfd;
     int server;
+    int busy; // transferring without the GIL
 } Abstract;
 
 
@@ -74,49 +185,252 @@ __socket_alloc(PyTypeObject *type, int server)
         self->name = NULL;
         self->fd = -1;
         self->size = -1;
+        self->rsize = -1;
+        self->sndbuf = 0;
+        self->rcvbuf = 0;
+        self->maxbuf = 0;
+        self->whits = 0;
+        self->rhits = 0;
+        self->family = AF_UNIX;
+        self->nodelay = 1;
+        self->quickack = 0;
+        self->keepalive = 0;
+        self->zerocopy = 0;
+        self->zcid = 0;
+        self->zcbufs = NULL;
+        self->zclen = 0;
+        self->zcalloc = 0;
+        self->memfd = 0;
+        self->fds = NULL;
+        self->nfds = 0;
+        self->fdsalloc = 0;
+        self->epfd = -1;
         self->server = server;
+        self->busy = 0;
         PyObject_GC_Track(self);
     }
     return self;
 }
 
 
+static inline int
+__socket_options(Abstract *self)
+{
+    int on = 1;
+
+    if (self->family == AF_UNIX) {
+        return 0;
+    }
+    if (
+        (self->server &&
+         setsockopt(self->fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on))) ||
+        (self->nodelay &&
+         setsockopt(self->fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on))) ||
+        (self->quickack &&
+         setsockopt(self->fd, IPPROTO_TCP, TCP_QUICKACK, &on, sizeof(on))) ||
+        (self->keepalive &&
+         (setsockopt(self->fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on)) ||
+          setsockopt(self->fd, IPPROTO_TCP, TCP_KEEPIDLE,
+                     &self->keepalive, sizeof(self->keepalive)) ||
+          setsockopt(self->fd, IPPROTO_TCP, TCP_KEEPINTVL,
+                     &self->keepalive, sizeof(self->keepalive))))
+#ifdef HAVE_ZEROCOPY
+        ||
+        (self->zerocopy &&
+         setsockopt(self->fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)))
+#endif
+       ) {
+        return -1;
+    }
+    return 0;
+}
+
+
+static inline int
+__socket_setup(Abstract *self)
+{
+    if (
+        __socket_options(self) ||
+        setsocksize(self->fd, SO_SNDBUF, self->sndbuf) ||
+        setsocksize(self->fd, SO_RCVBUF, self->rcvbuf) ||
+        ((self->size = getsocksize(self->fd, SO_SNDBUF)) == -1) ||
+        ((self->rsize = getsocksize(self->fd, SO_RCVBUF)) == -1)
+       ) {
+        return -1;
+    }
+    return 0;
+}
+
+
+static inline int
+__socket_open(Abstract *self, int family,
+              const struct sockaddr *addr, socklen_t addrlen)
+{
+    self->family = family;
+    if (
+        ((self->fd = socket(family, SOCK_TYPE, 0)) == -1) ||
+        __socket_setup(self) ||
+        ((self->server) ?
+         (bind(self->fd, addr, addrlen) || listen(self->fd, SOMAXCONN)) :
+         connect(self->fd, addr, addrlen))
+       ) {
+        return -1;
+    }
+    return 0;
+}
+
+
+/* "tcp:host:port" -> port, with name moved past the prefix; any other name is
+   an abstract unix name (NULL) */
+#define SOCK_TCP_PREFIX "tcp:"
+
+static inline int
+__socket_port(const char **name, Py_ssize_t *namelen, const char **port)
+{
+    const size_t prefixlen = sizeof(SOCK_TCP_PREFIX) - 1;
+    const char *_port_ = NULL;
+
+    *port = NULL;
+    if (strncmp(*name, SOCK_TCP_PREFIX, prefixlen)) {
+        return 0;
+    }
+    *name += prefixlen;
+    *namelen -= prefixlen;
+    if (!(_port_ = strrchr(*name, ':')) || !*(++_port_) ||
+        (strspn(_port_, "0123456789") != (size_t)(*name + *namelen - _port_))) {
+        PyErr_SetString(PyExc_ValueError, "Invalid tcp address");
+        return -1;
+    }
+    *port = _port_;
+    return 0;
+}
+
+
+static inline int
+__socket_unix(Abstract *self, const char *name, Py_ssize_t namelen)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX, .sun_path = "" };
+    socklen_t addrlen = offsetof(struct sockaddr_un, sun_path) + 1;
+
+    if ((size_t)namelen >= sizeof(addr.sun_path)) {
+        PyErr_SetString(PyExc_ValueError, "Name too long");
+        return -1;
+    }
+    memcpy(addr.sun_path + 1, name, namelen); //abstract namespace
+    addrlen += namelen;
+    self->zerocopy = 0; // MSG_ZEROCOPY is a TCP only feature
+    if (__socket_open(self, AF_UNIX, (struct sockaddr *)&addr, addrlen)) {
+        _PyErr_SetFromErrno();
+        return -1;
+    }
+    return 0;
+}
+
+
+static inline int
+__socket_inet(Abstract *self, const char *name, Py_ssize_t namelen,
+              const char *port)
+{
+    struct addrinfo hints = {
+        .ai_family = AF_UNSPEC,
+        .ai_socktype = SOCK_STREAM,
+        .ai_flags = (self->server) ? AI_PASSIVE : 0
+    };
+    struct addrinfo *info = NULL, *ai = NULL;
+    char host[NI_MAXHOST] = "";
+    size_t hostlen = (port - name) - 1;
+    int res = -1;
+
+    self->memfd = 0; // descriptors only go through unix sockets
+    // [::1]:port
+    if ((hostlen > 1) && (name[0] == '[') && (name[hostlen - 1] == ']')) {
+        name++;
+        hostlen -= 2;
+    }
+    if (hostlen >= sizeof(host)) {
+        PyErr_SetString(PyExc_ValueError, "Name too long");
+        return -1;
+    }
+    memcpy(host, name, hostlen);
+    if ((res = getaddrinfo((hostlen) ? host : NULL, port, &hints, &info))) {
+        PyErr_Format(PyExc_OSError, "%s: %s", (hostlen) ? host : "*",
+                     gai_strerror(res));
+        return -1;
+    }
+    for (res = -1, ai = info; ai; ai = ai->ai_next) {
+        if (!(res = __socket_open(self, ai->ai_family,
+                                  ai->ai_addr, ai->ai_addrlen))) {
+            break;
+        }
+        if (self->fd != -1) {
+            close(self->fd);
+            self->fd = -1;
+        }
+    }
+    freeaddrinfo(info);
+    if (res) {
+        _PyErr_SetFromErrno();
+    }
+    return res;
+}
+
+
 static inline int
 __socket_init(Abstract *self, PyObject *args, PyObject *kwargs)
 {
+    static char *kwlist[] = {
+        "name", "sndbuf", "rcvbuf", "maxbuf",
+        "nodelay", "quickack", "keepalive", "zerocopy", "memfd", NULL
+    };
     PyObject *name = NULL;
-    const char *_name_ = NULL;
+    const char *_name_ = NULL, *port = NULL;
     Py_ssize_t namelen = 0;
-    struct sockaddr_un addr = { .sun_family = AF_UNIX, .sun_path = "" };
-    socklen_t addrlen = offsetof(struct sockaddr_un, sun_path) + 1;
     int nbio = 1;
 
-    if (!PyArg_ParseTuple(args, "U:__new__", &name) ||
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "U|$iiippiii:__new__", kwlist,
+                                     &name, &self->sndbuf, &self->rcvbuf,
+                                     &self->maxbuf, &self->nodelay,
+                                     &self->quickack, &self->keepalive,
+                                     &self->zerocopy, &self->memfd) ||
         !(_name_ = PyUnicode_AsUTF8AndSize(name, &namelen))) {
         return -1;
     }
-    if (!namelen) {
-        PyErr_SetString(PyExc_ValueError, "Invalid argument");
+    if ((self->sndbuf < 0) || (self->rcvbuf < 0) || (self->maxbuf < 0)) {
+        PyErr_SetString(PyExc_ValueError, "Invalid buffer size");
         return -1;
     }
-    if ((size_t)namelen >= sizeof(addr.sun_path)) {
-        PyErr_SetString(PyExc_ValueError, "Name too long");
+    if (self->keepalive < 0) {
+        PyErr_SetString(PyExc_ValueError, "Invalid keepalive");
+        return -1;
+    }
+    if (self->zerocopy < 0) {
+        PyErr_SetString(PyExc_ValueError, "Invalid zerocopy threshold");
+        return -1;
+    }
+    if (self->memfd < 0) {
+        PyErr_SetString(PyExc_ValueError, "Invalid memfd threshold");
+        return -1;
+    }
+#ifndef HAVE_ZEROCOPY
+    self->zerocopy = 0;
+#endif
+    if (!namelen) {
+        PyErr_SetString(PyExc_ValueError, "Invalid argument");
         return -1;
     }
     if ((size_t)namelen != strlen(_name_)) {
         PyErr_SetString(PyExc_ValueError, "Embedded null character");
         return -1;
     }
-    memcpy(addr.sun_path + 1, _name_, namelen); //abstract namespace
-    addrlen += namelen;
     if (
-        ((self->fd = socket(AF_UNIX, SOCK_TYPE, 0)) == -1) ||
-        ((self->size = getsocksize(self->fd)) == -1) ||
-        ((self->server) ?
-         (bind(self->fd, &addr, addrlen) || listen(self->fd, SOMAXCONN)) :
-         connect(self->fd, &addr, addrlen)) ||
-        ioctl(self->fd, FIONBIO, &nbio)
+        __socket_port(&_name_, &namelen, &port) ||
+        ((port) ?
+         __socket_inet(self, _name_, namelen, port) :
+         __socket_unix(self, _name_, namelen))
        ) {
+        return -1;
+    }
+    if (ioctl(self->fd, FIONBIO, &nbio)) {
         _PyErr_SetFromErrno();
         return -1;
     }
@@ -138,11 +452,198 @@ __socket_new(PyTypeObject *type, PyObject *args, PyObject *kwargs, int server)
 }
 
 
+/* zerocopy ----------------------------------------------------------------- */
+
+/* the kernel reads the pages of buf until completion, keep it alive and
+   pinned (no resizing, see __buf_realloc()) until then */
+static inline int
+__zerocopy_hold(Abstract *self, PyByteArrayObject *buf)
+{
+    Py_ssize_t alloc = 0;
+    ZCBuffer *zcbufs = NULL;
+
+    if (self->zclen == self->zcalloc) {
+        alloc = (self->zcalloc) ? (self->zcalloc << 1) : 8;
+        if (!(zcbufs = PyMem_Realloc(self->zcbufs, (alloc * sizeof(ZCBuffer))))) {
+            PyErr_NoMemory();
+            return -1;
+        }
+        self->zcbufs = zcbufs;
+        self->zcalloc = alloc;
+    }
+    self->zcbufs[self->zclen].id = self->zcid - 1; // last send id
+    self->zcbufs[self->zclen].buf = __Py_INCREF((PyObject *)buf);
+    self->zclen++;
+    buf->ob_exports++;
+    return 0;
+}
+
+
+/* release the buffers whose last send id is within [lo, hi] */
+static inline void
+__zerocopy_release(Abstract *self, uint32_t lo, uint32_t hi)
+{
+    Py_ssize_t i, j;
+
+    for (i = 0, j = 0; i < self->zclen; i++) {
+        if ((uint32_t)(self->zcbufs[i].id - lo) <= (uint32_t)(hi - lo)) {
+            ((PyByteArrayObject *)self->zcbufs[i].buf)->ob_exports--;
+            Py_DECREF(self->zcbufs[i].buf);
+        }
+        else {
+            self->zcbufs[j++] = self->zcbufs[i];
+        }
+    }
+    self->zclen = j;
+}
+
+
+static inline void
+__zerocopy_clear(Abstract *self)
+{
+    while (self->zclen) {
+        ((PyByteArrayObject *)self->zcbufs[--self->zclen].buf)->ob_exports--;
+        Py_CLEAR(self->zcbufs[self->zclen].buf);
+    }
+    PyMem_Free(self->zcbufs);
+    self->zcbufs = NULL;
+    self->zcalloc = 0;
+}
+
+
+#ifdef HAVE_ZEROCOPY
+
+/* drain completion notifications from the socket error queue */
+static int
+__zerocopy_reap(Abstract *self)
+{
+    char control[CMSG_SPACE(sizeof(struct sock_extended_err) +
+                            sizeof(struct sockaddr_in6))];
+    struct msghdr msg = { .msg_control = control };
+    struct cmsghdr *cmsg = NULL;
+    struct sock_extended_err *serr = NULL;
+
+    while (self->zclen) {
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(self->fd, &msg, (MSG_ERRQUEUE | MSG_DONTWAIT)) == -1) {
+            return (errno == EAGAIN) ? 0 : -1;
+        }
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (((cmsg->cmsg_level == SOL_IP) && (cmsg->cmsg_type == IP_RECVERR)) ||
+                ((cmsg->cmsg_level == SOL_IPV6) && (cmsg->cmsg_type == IPV6_RECVERR))) {
+                serr = (struct sock_extended_err *)CMSG_DATA(cmsg);
+                if ((serr->ee_origin == SO_EE_ORIGIN_ZEROCOPY) && !serr->ee_errno) {
+                    // the kernel had to copy anyway (i.e. loopback), stop trying
+                    if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                        self->zerocopy = 0;
+                    }
+                    __zerocopy_release(self, serr->ee_info, serr->ee_data);
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+#else
+
+#define __zerocopy_reap(s) 0
+
+#endif /* HAVE_ZEROCOPY */
+
+
+/* fd passing --------------------------------------------------------------- */
+
+/* queue descriptors received with SCM_RIGHTS, closes them on failure */
+static inline int
+__fds_push(Abstract *self, int *fds, Py_ssize_t n)
+{
+    Py_ssize_t alloc = 0;
+    int *_fds_ = NULL;
+
+    if ((self->nfds + n) > self->fdsalloc) {
+        alloc = Py_MAX((self->nfds + n), (self->fdsalloc << 1));
+        if (!(_fds_ = PyMem_Realloc(self->fds, (alloc * sizeof(int))))) {
+            while (n) {
+                close(fds[--n]);
+            }
+            errno = ENOMEM;
+            return -1;
+        }
+        self->fds = _fds_;
+        self->fdsalloc = alloc;
+    }
+    memcpy((self->fds + self->nfds), fds, (n * sizeof(int)));
+    self->nfds += n;
+    return 0;
+}
+
+
+/* the first received descriptor, the caller is responsible for it */
+static inline int
+__fds_pop(Abstract *self)
+{
+    int fd = -1;
+
+    if (!self->nfds) {
+        PyErr_SetString(PyExc_ValueError, "Not enough descriptors");
+        return -1;
+    }
+    fd = self->fds[0];
+    memmove(self->fds, (self->fds + 1), (--self->nfds * sizeof(int)));
+    return fd;
+}
+
+
+static inline void
+__fds_clear(Abstract *self)
+{
+    while (self->nfds) {
+        close(self->fds[--self->nfds]);
+    }
+    PyMem_Free(self->fds);
+    self->fds = NULL;
+    self->fdsalloc = 0;
+}
+
+
+/* the GIL is released during transfers, another thread may neither transfer
+   on the socket at the same time nor close it (the fd could be reused under
+   the transfer) */
+static inline int
+__socket_acquire(Abstract *self)
+{
+    if (self->busy) {
+        PyErr_SetString(PyExc_RuntimeError, "socket busy in another thread");
+        return -1;
+    }
+    self->busy = 1;
+    return 0;
+}
+
+
+static inline void
+__socket_release(Abstract *self)
+{
+    self->busy = 0;
+}
+
+
 static inline int
 __socket_close(Abstract *self)
 {
     int res = 0;
 
+    if (self->busy) {
+        PyErr_SetString(PyExc_RuntimeError, "socket busy in another thread");
+        return -1;
+    }
+    __zerocopy_clear(self);
+    __fds_clear(self);
+    if (self->epfd != -1) {
+        close(self->epfd);
+        self->epfd = -1;
+    }
     if (self->fd != -1) {
         if ((res = close(self->fd))) {
             _PyErr_SetFromErrno();
@@ -153,13 +654,36 @@ __socket_close(Abstract *self)
 }
 
 
+/* reset the connection, closing it would still send what is queued */
+static inline void
+__socket_abort(Abstract *self)
+{
+    struct linger linger = { .l_onoff = 1, .l_linger = 0 };
+    PyObject *exc_type, *exc_value, *exc_traceback;
+
+    PyErr_Fetch(&exc_type, &exc_value, &exc_traceback);
+    if (self->fd != -1) {
+        setsockopt(self->fd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+    }
+    if (__socket_close(self)) {
+        PyErr_Clear();
+    }
+    PyErr_Restore(exc_type, exc_value, exc_traceback);
+}
+
+
 /* Abstract_Type ------------------------------------------------------------ */
 
 /* Abstract_Type.tp_traverse */
 static int
 Abstract_tp_traverse(Abstract *self, visitproc visit, void *arg)
 {
+    Py_ssize_t i;
+
     Py_VISIT(self->name);
+    for (i = 0; i < self->zclen; i++) {
+        Py_VISIT(self->zcbufs[i].buf);
+    }
     return 0;
 }
 
@@ -169,6 +693,8 @@ static int
 Abstract_tp_clear(Abstract *self)
 {
     Py_CLEAR(self->name);
+    __zerocopy_clear(self);
+    __fds_clear(self);
     return 0;
 }
 
@@ -233,9 +759,36 @@ Abstract_closed_get(Abstract *self, void *closure)
 }
 
 
+/* Abstract.sndbuf */
+static PyObject *
+Abstract_sndbuf_get(Abstract *self, void *closure)
+{
+    return PyLong_FromLong(self->size);
+}
+
+
+/* Abstract.rcvbuf */
+static PyObject *
+Abstract_rcvbuf_get(Abstract *self, void *closure)
+{
+    return PyLong_FromLong(self->rsize);
+}
+
+
+/* Abstract.memfd */
+static PyObject *
+Abstract_memfd_get(Abstract *self, void *closure)
+{
+    return PyLong_FromLong(self->memfd);
+}
+
+
 /* Abstract_Type.tp_getset */
 static PyGetSetDef Abstract_tp_getset[] = {
     {"closed", (getter)Abstract_closed_get, _Py_READONLY_ATTRIBUTE, NULL, NULL},
+    {"sndbuf", (getter)Abstract_sndbuf_get, _Py_READONLY_ATTRIBUTE, NULL, NULL},
+    {"rcvbuf", (getter)Abstract_rcvbuf_get, _Py_READONLY_ATTRIBUTE, NULL, NULL},
+    {"memfd", (getter)Abstract_memfd_get, _Py_READONLY_ATTRIBUTE, NULL, NULL},
     {NULL}  /* Sentinel */
 };
 
@@ -288,6 +841,12 @@ __buf_realloc(PyByteArrayObject *buf, Py_ssize_t nalloc)
     Py_ssize_t alloc = 0;
     void *bytes = NULL;
 
+    // reclaim the space left in front by consumed data first
+    if ((buf->ob_start != buf->ob_bytes) &&
+        (buf->ob_alloc < ((buf->ob_start - buf->ob_bytes) + nalloc))) {
+        memmove(buf->ob_bytes, buf->ob_start, Py_SIZE(buf));
+        buf->ob_start = buf->ob_bytes;
+    }
     if (buf->ob_alloc < nalloc) {
         alloc = Py_MAX(nalloc, (buf->ob_alloc << 1));
         if (!(bytes = PyObject_Realloc(buf->ob_bytes, alloc))) {
@@ -311,31 +870,234 @@ __buf_resize(PyByteArrayObject *buf, size_t size)
 }
 
 
-/* Socket_Type -------------------------------------------------------------- */
+/* size of the frame header and payload at the start of buf,
+   0 if incomplete */
+static int
+__frame_size(PyByteArrayObject *buf, Py_ssize_t *hlen, Py_ssize_t *size)
+{
+    const char *start = buf->ob_start;
+    Py_ssize_t len = Py_SIZE(buf);
+    int8_t i1 = 0;
+    int16_t i2 = 0;
+    int32_t i4 = 0;
+    int64_t i8 = 0;
 
-/* Socket.write(buf) */
-PyDoc_STRVAR(Socket_write_doc,
-"write(buf)");
+    if (len < 1) {
+        return 0;
+    }
+    if ((*hlen = 1 + (uint8_t)start[0]) == (1 + SOCK_MEMFD_FRAME)) {
+        *hlen = 1;
+        *size = 0;
+        return 1;
+    }
+    if (len < *hlen) {
+        return 0;
+    }
+    switch (*hlen - 1) {
+        case 1:
+            memcpy(&i1, (start + 1), 1);
+            *size = i1;
+            break;
+        case 2:
+            memcpy(&i2, (start + 1), 2);
+            *size = i2;
+            break;
+        case 4:
+            memcpy(&i4, (start + 1), 4);
+            *size = i4;
+            break;
+        case 8:
+            memcpy(&i8, (start + 1), 8);
+            *size = i8;
+            break;
+        default:
+            *size = -1;
+            break;
+    }
+    if (*size < 0) {
+        PyErr_SetString(PyExc_ValueError, "Invalid frame");
+        return -1;
+    }
+    return (len >= (*hlen + *size));
+}
 
-static PyObject *
-Socket_write(Abstract *self, PyObject *args)
+
+/* grow the socket buffer behind *size when frames of len bytes keep exceeding
+   it, up to maxbuf */
+static inline int
+__socket_adapt(Abstract *self, int optname, int *size, int *hits, Py_ssize_t len)
 {
-    PyByteArrayObject *buf = NULL;
-    Py_ssize_t len = 0, size = -1;
+    int nsize = 0;
 
-    if (!PyArg_ParseTuple(args, "Y:write", &buf)) {
-        return NULL;
+    if (len <= *size) {
+        *hits = 0;
     }
-    len = Py_SIZE(buf);
+    else if ((*size < self->maxbuf) && (++(*hits) >= SOCK_ADAPT_HITS)) {
+        *hits = 0;
+        nsize = (int)Py_MIN(Py_MAX(len, ((Py_ssize_t)*size << 1)), self->maxbuf);
+        if (
+            setsocksize(self->fd, optname, nsize) ||
+            ((nsize = getsocksize(self->fd, optname)) == -1)
+           ) {
+            return -1;
+        }
+        *size = nsize;
+    }
+    return 0;
+}
+
+#define __socket_adapt_write(s, l) \
+    __socket_adapt(s, SO_SNDBUF, &(s)->size, &(s)->whits, l)
+
+#define __socket_adapt_read(s, l) \
+    __socket_adapt(s, SO_RCVBUF, &(s)->rsize, &(s)->rhits, l)
+
+
+/* Socket_Type -------------------------------------------------------------- */
+
+/* Socket.write(buf) */
+PyDoc_STRVAR(Socket_write_doc,
+"write(buf)");
+
+static inline Py_ssize_t
+__socket_write(Abstract *self, PyByteArrayObject *buf, Py_ssize_t len, int zc)
+{
+    Py_ssize_t size = -1;
+
+    SOCK_BEGIN_ALLOW_THREADS(len >= SOCK_NOGIL)
+#ifdef HAVE_ZEROCOPY
+    size = (zc) ?
+        send(self->fd, buf->ob_start, len, (MSG_ZEROCOPY | MSG_NOSIGNAL)) :
+        write(self->fd, buf->ob_start, len);
+#else
+    size = write(self->fd, buf->ob_start, len);
+#endif
+    SOCK_END_ALLOW_THREADS
+    if (zc && (size != -1)) {
+        self->zcid++; // every successful call gets a notification id
+    }
+    return size;
+}
+
+
+/* hand a frame over in a sealed memfd, only the marker byte goes through the
+   socket buffer */
+static inline int
+__socket_memfd(Abstract *self, PyByteArrayObject *buf, Py_ssize_t len)
+{
+    char mark = (char)SOCK_MEMFD_FRAME;
+    char control[CMSG_SPACE(sizeof(int))] = { 0 };
+    struct iovec iov = { .iov_base = &mark, .iov_len = 1 };
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control,
+        .msg_controllen = sizeof(control)
+    };
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    Py_ssize_t offset = 0, size = -1;
+    int fd = -1, res = -1, err = 0;
+
+    if ((fd = memfd_create("ippc", (MFD_CLOEXEC | MFD_ALLOW_SEALING))) == -1) {
+        return -1;
+    }
+    SOCK_BEGIN_ALLOW_THREADS(len >= SOCK_NOGIL)
+    for (offset = 0; offset < len; offset += size) {
+        if ((size = write(fd, (buf->ob_start + offset), (len - offset))) == -1) {
+            break;
+        }
+    }
+    SOCK_END_ALLOW_THREADS
+    if ((size != -1) && !fcntl(fd, F_ADD_SEALS, SOCK_MEMFD_SEALS)) {
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+        res = (sendmsg(self->fd, &msg, MSG_NOSIGNAL) == 1) ? 0 : -1;
+    }
+    err = errno;
+    close(fd); // the peer holds its own reference once sent
+    errno = err;
+    if (!res) {
+        buf->ob_start += len;
+        __buf_terminate(buf, 0);
+    }
+    return res;
+}
+
+
+static int
+__socket_send(Abstract *self, PyByteArrayObject *buf)
+{
+    Py_ssize_t len = Py_SIZE(buf), size = -1;
+    uint32_t zcid = self->zcid;
+    int zc = 0, res = 0;
+
+    if (self->memfd && (len >= self->memfd) && (buf->ob_start == buf->ob_bytes)) {
+        if (__socket_acquire(self)) {
+            return -1;
+        }
+        buf->ob_exports++; // no resizing by other threads without the GIL
+        res = __socket_memfd(self, buf, len);
+        buf->ob_exports--;
+        __socket_release(self);
+        if (res) {
+            _PyErr_SetFromErrno();
+        }
+        return res;
+    }
+    // only account for fresh frames, not for the remainder of a partial write
+    if (
+        (self->maxbuf && (buf->ob_start == buf->ob_bytes) &&
+         __socket_adapt_write(self, len)) ||
+        (self->zclen && __zerocopy_reap(self))
+       ) {
+        _PyErr_SetFromErrno();
+        return -1;
+    }
+    zc = (self->zerocopy && (len >= self->zerocopy));
+    if (__socket_acquire(self)) {
+        return -1;
+    }
+    buf->ob_exports++; // no resizing by other threads without the GIL
     while (len > 0) {
-        size = write(self->fd, buf->ob_start, Py_MIN(len, self->size));
+        size = __socket_write(self, buf, Py_MIN(len, self->size), zc);
         if (size == -1) {
-            return _PyErr_SetFromErrno();
+            if (zc && (errno == ENOBUFS)) {
+                // out of optmem for pinned pages, copy instead
+                zc = 0;
+                continue;
+            }
+            res = -1;
+            break;
         }
         // XXX: very bad shortcut ¯\_(ツ)_/¯
         buf->ob_start += size;
         len = __buf_terminate(buf, (len - size));
     }
+    buf->ob_exports--;
+    __socket_release(self);
+    if ((self->zcid != zcid) && __zerocopy_hold(self, buf)) {
+        // the pages are in flight and cannot be protected, abort the
+        // connection (unsent data is discarded) rather than corrupt it
+        __socket_abort(self);
+        return -1;
+    }
+    if (res) {
+        _PyErr_SetFromErrno();
+    }
+    return res;
+}
+
+
+static PyObject *
+Socket_write(Abstract *self, PyObject *args)
+{
+    PyByteArrayObject *buf = NULL;
+
+    if (!PyArg_ParseTuple(args, "Y:write", &buf) || __socket_send(self, buf)) {
+        return NULL;
+    }
     Py_RETURN_NONE;
 }
 
@@ -344,34 +1106,214 @@ Socket_write(Abstract *self, PyObject *args)
 PyDoc_STRVAR(Socket_read_doc,
 "read(buf) -> bool");
 
+static inline Py_ssize_t
+__socket_read(Abstract *self, char *data, Py_ssize_t len)
+{
+    char control[CMSG_SPACE(sizeof(int) * SOCK_MAXFDS)];
+    struct iovec iov = { .iov_base = data, .iov_len = len };
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control,
+        .msg_controllen = sizeof(control)
+    };
+    struct cmsghdr *cmsg = NULL;
+    Py_ssize_t size = -1;
+
+    SOCK_BEGIN_ALLOW_THREADS(len >= SOCK_NOGIL)
+    size = (self->family == AF_UNIX) ?
+        recvmsg(self->fd, &msg, MSG_CMSG_CLOEXEC) : read(self->fd, data, len);
+    SOCK_END_ALLOW_THREADS
+    // descriptors sent along are queued, see recvfds()
+    if ((self->family == AF_UNIX) && (size != -1)) {
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if ((cmsg->cmsg_level == SOL_SOCKET) &&
+                (cmsg->cmsg_type == SCM_RIGHTS) &&
+                __fds_push(self, (int *)CMSG_DATA(cmsg),
+                           ((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int)))) {
+                return -1;
+            }
+        }
+        if (msg.msg_flags & MSG_CTRUNC) {
+            errno = EMSGSIZE;
+            return -1;
+        }
+    }
+    return size;
+}
+
+
+/* append what is pending to buf, 1 on eof */
+static int
+__socket_recv(Abstract *self, PyByteArrayObject *buf)
+{
+    Py_ssize_t len = Py_SIZE(buf), size = -1, hlen = 0, fsize = -1;
+    int fresh = !len, nread = 0;
+
+    if (
+        (self->zclen && __zerocopy_reap(self)) ||
+        ioctl(self->fd, FIONREAD, &nread)
+       ) {
+        _PyErr_SetFromErrno();
+        return -1;
+    }
+    // nothing pending: either eof or a wakeup for the error queue only,
+    // read(1) tells them apart (0 or EAGAIN)
+    if (!nread) {
+        nread = 1;
+    }
+    if (__buf_resize(buf, (len + nread)) || __socket_acquire(self)) {
+        return -1;
+    }
+    buf->ob_exports++; // no resizing by other threads without the GIL
+    do {
+        if ((size = __socket_read(self, (buf->ob_start + len), nread)) > 0) {
+            nread -= size;
+            len = __buf_terminate(buf, (len + size));
+        }
+    } while ((size > 0) && (nread > 0));
+    buf->ob_exports--;
+    __socket_release(self);
+    if (size == -1) {
+        _PyErr_SetFromErrno();
+        return -1;
+    }
+    // only account for fresh frames, sized by their header; SO_RCVBUF does
+    // nothing for unix sockets, the writer adapts its own SO_SNDBUF instead
+    if (self->maxbuf && fresh && (self->family != AF_UNIX)) {
+        if (__frame_size(buf, &hlen, &fsize) == -1) {
+            PyErr_Clear(); // reported when the frame is read
+        }
+        else if ((fsize >= 0) && __socket_adapt_read(self, (hlen + fsize))) {
+            _PyErr_SetFromErrno();
+            return -1;
+        }
+    }
+    // TCP_QUICKACK is not permanent, re-arm it after every read
+    if (self->quickack && (self->family != AF_UNIX) &&
+        setsockopt(self->fd, IPPROTO_TCP, TCP_QUICKACK,
+                   &self->quickack, sizeof(self->quickack))) {
+        _PyErr_SetFromErrno();
+        return -1;
+    }
+    return (size == 0);
+}
+
+
 static PyObject *
 Socket_read(Abstract *self, PyObject *args)
 {
     PyByteArrayObject *buf = NULL;
-    Py_ssize_t len = 0, size = -1;
-    int nread = 0;
+    int res = -1;
 
-    if (!PyArg_ParseTuple(args, "Y:read", &buf)) {
+    if (!PyArg_ParseTuple(args, "Y:read", &buf) ||
+        ((res = __socket_recv(self, buf)) == -1)) {
         return NULL;
     }
-    len = Py_SIZE(buf);
-    if (ioctl(self->fd, FIONREAD, &nread)) {
-        return _PyErr_SetFromErrno();
+    return PyBool_FromLong(res);
+}
+
+
+/* Socket.sendfds(buf, fds) */
+PyDoc_STRVAR(Socket_sendfds_doc,
+"sendfds(buf, fds)");
+
+static inline int
+__socket_sendfds(Abstract *self, Py_buffer *data, PyObject *fds)
+{
+    char control[CMSG_SPACE(sizeof(int) * SOCK_MAXFDS)] = { 0 };
+    struct iovec iov = { .iov_base = data->buf, .iov_len = data->len };
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1 };
+    struct cmsghdr *cmsg = NULL;
+    Py_ssize_t i, n = PySequence_Fast_GET_SIZE(fds), size = -1;
+    int *_fds_ = NULL;
+
+    if (!data->len || !n || (n > SOCK_MAXFDS)) {
+        PyErr_SetString(PyExc_ValueError, "Invalid argument");
+        return -1;
     }
-    if (nread && __buf_resize(buf, (len + nread))) {
-        return NULL;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * n);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * n);
+    _fds_ = (int *)CMSG_DATA(cmsg);
+    for (i = 0; i < n; i++) {
+        if ((_fds_[i] =
+             PyObject_AsFileDescriptor(PySequence_Fast_GET_ITEM(fds, i))) == -1) {
+            return -1;
+        }
     }
-    do {
-        size = read(self->fd, (buf->ob_start + len), nread);
-        if (size == -1) {
-            return _PyErr_SetFromErrno();
+    // the descriptors go with the first chunk, the rest is a plain stream
+    while (iov.iov_len) {
+        if ((size = sendmsg(self->fd, &msg, MSG_NOSIGNAL)) == -1) {
+            _PyErr_SetFromErrno();
+            return -1;
         }
-        if (size) {
-            nread -= size;
-            len = __buf_terminate(buf, (len + size));
+        iov.iov_base = (char *)iov.iov_base + size;
+        iov.iov_len -= size;
+        msg.msg_control = NULL;
+        msg.msg_controllen = 0;
+    }
+    return 0;
+}
+
+
+static PyObject *
+Socket_sendfds(Abstract *self, PyObject *args)
+{
+    Py_buffer data;
+    PyObject *fds = NULL, *seq = NULL;
+    int res = -1;
+
+    if (!PyArg_ParseTuple(args, "y*O:sendfds", &data, &fds)) {
+        return NULL;
+    }
+    if ((seq = PySequence_Fast(fds, "fds must be a sequence"))) {
+        res = __socket_sendfds(self, &data, seq);
+        Py_DECREF(seq);
+    }
+    PyBuffer_Release(&data);
+    return (res) ? NULL : __Py_INCREF(Py_None);
+}
+
+
+/* Socket.recvfds([count]) */
+PyDoc_STRVAR(Socket_recvfds_doc,
+"recvfds([count]) -> tuple");
+
+// the first count (all by default) received descriptors, in order, the
+// caller is responsible for them
+static PyObject *
+Socket_recvfds(Abstract *self, PyObject *args)
+{
+    PyObject *result = NULL, *item = NULL;
+    Py_ssize_t i, count = -1;
+
+    if (!PyArg_ParseTuple(args, "|n:recvfds", &count)) {
+        return NULL;
+    }
+    if (count < 0) {
+        count = self->nfds;
+    }
+    else if (count > self->nfds) {
+        PyErr_SetString(PyExc_ValueError, "Not enough descriptors");
+        return NULL;
+    }
+    if (!(result = PyTuple_New(count))) {
+        return NULL;
+    }
+    for (i = 0; i < count; i++) {
+        if (!(item = PyLong_FromLong(self->fds[i]))) {
+            Py_CLEAR(result);
+            return NULL;
         }
-    } while (nread > 0);
-    return PyBool_FromLong((size == 0));
+        PyTuple_SET_ITEM(result, i, item);
+    }
+    self->nfds -= count;
+    memmove(self->fds, (self->fds + count), (self->nfds * sizeof(int)));
+    return result;
 }
 
 
@@ -379,6 +1321,8 @@ Socket_read(Abstract *self, PyObject *args)
 static PyMethodDef Socket_tp_methods[] = {
     {"write", (PyCFunction)Socket_write, METH_VARARGS, Socket_write_doc},
     {"read", (PyCFunction)Socket_read, METH_VARARGS, Socket_read_doc},
+    {"sendfds", (PyCFunction)Socket_sendfds, METH_VARARGS, Socket_sendfds_doc},
+    {"recvfds", (PyCFunction)Socket_recvfds, METH_VARARGS, Socket_recvfds_doc},
     {NULL}  /* Sentinel */
 };
 
@@ -396,6 +1340,35 @@ static PyTypeObject Socket_Type = {
    Server
    -------------------------------------------------------------------------- */
 
+static Abstract *
+__socket_accepted(Abstract *self, int fd)
+{
+    Abstract *result = NULL;
+
+    if (!(result = __socket_alloc(&Socket_Type, 0))) {
+        close(fd);
+        return NULL;
+    }
+    result->fd = fd;
+    result->sndbuf = self->sndbuf;
+    result->rcvbuf = self->rcvbuf;
+    result->maxbuf = self->maxbuf;
+    result->family = self->family;
+    result->nodelay = self->nodelay;
+    result->quickack = self->quickack;
+    result->keepalive = self->keepalive;
+    result->zerocopy = self->zerocopy;
+    result->memfd = self->memfd;
+    if (__socket_setup(result)) {
+        _PyErr_SetFromErrno();
+        Py_CLEAR(result);
+        return NULL;
+    }
+    _Py_SET_MEMBER(result->name, self->name);
+    return result;
+}
+
+
 /* Server.accept() */
 PyDoc_STRVAR(Server_accept_doc,
 "accept() -> Socket");
@@ -403,25 +1376,58 @@ PyDoc_STRVAR(Server_accept_doc,
 static PyObject *
 Server_accept(Abstract *self)
 {
-    Abstract *result = NULL;
+    struct epoll_event event;
+    int fd = -1;
 
-    if ((result = __socket_alloc(&Socket_Type, 0))) {
-        if (
-            ((result->fd = accept4(self->fd, NULL, NULL, SOCK_FLAGS)) == -1) ||
-            ((result->size = getsocksize(result->fd)) == -1)
-           ) {
-            Py_CLEAR(result);
+    if (__socket_acquire(self)) {
+        return NULL;
+    }
+    Py_BEGIN_ALLOW_THREADS
+    fd = accept4(self->fd, NULL, NULL, SOCK_FLAGS);
+    Py_END_ALLOW_THREADS
+    __socket_release(self);
+    if (fd == -1) {
+        // backlog drained, reset the readiness of the exclusive epoll
+        if ((errno == EAGAIN) && (self->epfd != -1)) {
+            epoll_wait(self->epfd, &event, 1, 0);
+            errno = EAGAIN;
+        }
+        return _PyErr_SetFromErrno();
+    }
+    return (PyObject *)__socket_accepted(self, fd);
+}
+
+
+/* Server.exclusive() */
+PyDoc_STRVAR(Server_exclusive_doc,
+"exclusive() -> int");
+
+// an epoll fd private to the calling process, readable when a connection is
+// pending; processes sharing the socket are woken one at a time (EPOLLEXCLUSIVE)
+static PyObject *
+Server_exclusive(Abstract *self)
+{
+    struct epoll_event event = { .events = (EPOLLIN | EPOLLEXCLUSIVE) };
+
+    if (self->epfd == -1) {
+        if ((self->epfd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
             return _PyErr_SetFromErrno();
         }
-        _Py_SET_MEMBER(result->name, self->name);
+        if (epoll_ctl(self->epfd, EPOLL_CTL_ADD, self->fd, &event)) {
+            _PyErr_SetFromErrno();
+            close(self->epfd);
+            self->epfd = -1;
+            return NULL;
+        }
     }
-    return (PyObject *)result;
+    return PyLong_FromLong(self->epfd);
 }
 
 
 /* Server_Type.tp_methods */
 static PyMethodDef Server_tp_methods[] = {
     {"accept", (PyCFunction)Server_accept, METH_NOARGS, Server_accept_doc},
+    {"exclusive", (PyCFunction)Server_exclusive, METH_NOARGS, Server_exclusive_doc},
     {NULL}  /* Sentinel */
 };
 
@@ -448,48 +1454,3329 @@ static PyTypeObject Server_Type = {
    Client
    -------------------------------------------------------------------------- */
 
-/* Client_Type.tp_new */
-static PyObject *
-Client_tp_new(PyTypeObject *type, PyObject *args, PyObject *kwargs)
+/* Client_Type -------------------------------------------------------------- */
+
+static inline int64_t
+__clock_ns(void)
 {
-    return __socket_new(type, args, kwargs, 0);
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((int64_t)ts.tv_sec * 1000000000) + ts.tv_nsec;
 }
 
 
-static PyTypeObject Client_Type = {
-    PyVarObject_HEAD_INIT(NULL, 0)
-    .tp_name = "mood.ippc.sockets.ClientSocket",
-    .tp_basicsize = sizeof(Abstract),
-    .tp_flags = (Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE),
-    .tp_new = Client_tp_new,
-};
+/* wait for events with the GIL released */
+static int
+__socket_poll(Abstract *self, short events)
+{
+    struct pollfd pfd = { .fd = self->fd, .events = events };
+    int res = -1;
+
+    if (__socket_acquire(self)) {
+        return -1;
+    }
+    do {
+        Py_BEGIN_ALLOW_THREADS
+        res = poll(&pfd, 1, -1);
+        Py_END_ALLOW_THREADS
+    } while ((res == -1) && (errno == EINTR) && !PyErr_CheckSignals());
+    __socket_release(self);
+    if (res == -1) {
+        if (!PyErr_Occurred()) {
+            _PyErr_SetFromErrno();
+        }
+        return -1;
+    }
+    return 0;
+}
 
 
-/* --------------------------------------------------------------------------
-   module
-   -------------------------------------------------------------------------- */
+/* busy-poll for input until deadline, also without the GIL so that other
+   threads are not starved meanwhile */
+static int
+__socket_spin(Abstract *self, int64_t deadline)
+{
+    struct pollfd pfd = { .fd = self->fd, .events = POLLIN };
 
-/* sockets_def */
-static PyModuleDef sockets_def = {
-    PyModuleDef_HEAD_INIT,
-    .m_name = "ippc.sockets",
-    .m_doc = "ippc.sockets module",
-    .m_size = 0,
-};
+    if (__socket_acquire(self)) {
+        return -1;
+    }
+    Py_BEGIN_ALLOW_THREADS
+    while (!poll(&pfd, 1, 0) && (__clock_ns() < deadline)) {
+        // nothing in yet
+    }
+    Py_END_ALLOW_THREADS
+    __socket_release(self);
+    return 0;
+}
 
 
 static inline int
-_module_init(PyObject *module)
+__socket_blocked(void)
+{
+    if (PyErr_ExceptionMatches(PyExc_BlockingIOError)) {
+        PyErr_Clear();
+        return 1;
+    }
+    return 0;
+}
+
+
+static PyObject *
+__frame_decode(const char *data, Py_ssize_t len, PyObject *decode,
+               int *released)
+{
+    PyObject *view = NULL, *result = NULL, *res = NULL;
+
+    *released = 1;
+    if ((view = PyMemoryView_FromMemory((char *)data, len, PyBUF_READ))) {
+        result = PyObject_CallFunctionObjArgs(decode, view, NULL);
+        // nothing may keep pointing at data once we return
+        if ((res = PyObject_CallMethod(view, "release", NULL))) {
+            Py_DECREF(res);
+        }
+        else {
+            *released = 0;
+            Py_CLEAR(result);
+        }
+        Py_DECREF(view);
+    }
+    return result;
+}
+
+
+/* decode a frame handed over in a memfd (see Socket.write()) */
+static PyObject *
+__frame_decode_memfd(Abstract *self, PyObject *decode)
 {
+    struct stat st;
+    PyObject *result = NULL;
+    char *map = NULL;
+    Py_ssize_t hlen = 0;
+    int fd = -1, seals = 0, released = 1;
+
+    if ((fd = __fds_pop(self)) == -1) {
+        return NULL;
+    }
     if (
-        PyModule_AddStringConstant(module, "__version__", PKG_VERSION) ||
-        PyType_Ready(&Abstract_Type) ||
-        _PyType_ReadyWithBase(&Socket_Type, &Abstract_Type) ||
-        _PyModule_AddTypeWithBase(module, "ServerSocket", &Server_Type, &Abstract_Type) ||
-        _PyModule_AddTypeWithBase(module, "ClientSocket", &Client_Type, &Socket_Type)
+        fstat(fd, &st) ||
+        ((seals = fcntl(fd, F_GET_SEALS)) == -1) ||
+        ((map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)
        ) {
+        _PyErr_SetFromErrno();
+        close(fd);
+        return NULL;
+    }
+    close(fd);
+    hlen = (st.st_size) ? 1 + (uint8_t)map[0] : 0;
+    if (
+        ((seals & (F_SEAL_SHRINK | F_SEAL_WRITE)) != (F_SEAL_SHRINK | F_SEAL_WRITE)) ||
+        !hlen || (hlen > st.st_size)
+       ) {
+        PyErr_SetString(PyExc_ValueError, "Invalid memfd frame");
+    }
+    else {
+        result = __frame_decode((map + hlen), (st.st_size - hlen), decode,
+                                &released);
+    }
+    // still exported (decode kept a reference), leak it rather than crash
+    if (released) {
+        munmap(map, st.st_size);
+    }
+    return result;
+}
+
+
+/* Client.call(msg, buf, decode[, spin]) */
+PyDoc_STRVAR(Client_call_doc,
+"call(msg, buf, decode[, spin]) -> obj");
+
+// blocking request/reply: sends msg, then reads into buf (unconsumed data
+// stays there) until a full reply frame is in, returns decode(payload);
+// spin is the time (ns) to busy-poll before sleeping in poll()
+static PyObject *
+Client_call(Abstract *self, PyObject *args)
+{
+    PyByteArrayObject *msg = NULL, *buf = NULL;
+    PyObject *decode = NULL, *result = NULL;
+    long long spin = 0;
+    int64_t deadline = 0;
+    Py_ssize_t hlen = 0, size = 0;
+    int res = 0, released = 0;
+
+    if (!PyArg_ParseTuple(args, "YYO|L:call", &msg, &buf, &decode, &spin)) {
+        return NULL;
+    }
+    if (self->fd == -1) {
+        PyErr_SetString(PyExc_ValueError, "I/O operation on closed socket");
+        return NULL;
+    }
+    while (Py_SIZE(msg)) {
+        if (__socket_send(self, msg) &&
+            (!__socket_blocked() || __socket_poll(self, POLLOUT))) {
+            return NULL;
+        }
+    }
+    deadline = (spin > 0) ? (__clock_ns() + spin) : 0;
+    while (!(res = __frame_size(buf, &hlen, &size))) {
+        if ((res = __socket_recv(self, buf)) == 1) {
+            PyErr_SetString(PyExc_ConnectionResetError, "closed by peer");
+            return NULL;
+        }
+        if (res && (!__socket_blocked() ||
+                    ((deadline && (__clock_ns() < deadline)) ?
+                     __socket_spin(self, deadline) :
+                     __socket_poll(self, POLLIN)))) {
+            return NULL;
+        }
+    }
+    if (res == -1) {
+        return NULL;
+    }
+    if ((uint8_t)buf->ob_start[0] == SOCK_MEMFD_FRAME) {
+        result = __frame_decode_memfd(self, decode);
+    }
+    else {
+        result = __frame_decode((buf->ob_start + hlen), size, decode, &released);
+    }
+    // consumed either way
+    buf->ob_start += (hlen + size);
+    __buf_terminate(buf, (Py_SIZE(buf) - (hlen + size)));
+    return result;
+}
+
+
+/* Client_Type.tp_methods */
+static PyMethodDef Client_tp_methods[] = {
+    {"call", (PyCFunction)Client_call, METH_VARARGS, Client_call_doc},
+    {NULL}  /* Sentinel */
+};
+
+
+/* Client_Type.tp_new */
+static PyObject *
+Client_tp_new(PyTypeObject *type, PyObject *args, PyObject *kwargs)
+{
+    return __socket_new(type, args, kwargs, 0);
+}
+
+
+static PyTypeObject Client_Type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "mood.ippc.sockets.ClientSocket",
+    .tp_basicsize = sizeof(Abstract),
+    .tp_flags = (Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE),
+    .tp_methods = Client_tp_methods,
+    .tp_new = Client_tp_new,
+};
+
+
+/* --------------------------------------------------------------------------
+   Channel
+   -------------------------------------------------------------------------- */
+
+#define CHANNEL_SIZE 65536
+#define CHANNEL_SEALS (F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL)
+#define CHANNEL_EFD_FLAGS (EFD_CLOEXEC | EFD_NONBLOCK)
+
+
+/* one direction of a channel, single producer/single consumer, positions and
+   flags of each side live in their own cache line */
+typedef struct {
+    uint64_t head __attribute__((aligned(64))); // consumer position
+    uint64_t tail __attribute__((aligned(64))); // producer position
+    uint32_t rwait __attribute__((aligned(64))); // consumer wants a doorbell
+    uint32_t wwait; // producer wants a doorbell
+} ChannelRing;
+
+
+/* Channel: memfd = [ring0][ring1][data0][data1], the creator (side 0) writes
+   to ring0 and reads from ring1; each side has 2 doorbells, one rung when there
+   is data to read and one rung when there is room to write, so that the reader
+   and the writer never swallow each other's wakeups */
+typedef struct {
+    PyObject_HEAD
+    int fd;
+    int efds[4];
+    int side;
+    int full;
+    size_t size;
+    size_t len;
+    char *map;
+} Channel;
+
+
+#define __channel_ring(s, r) (((ChannelRing *)(s)->map) + (r))
+
+#define __channel_data(s, r) \
+    ((s)->map + (2 * sizeof(ChannelRing)) + ((r) * (s)->size))
+
+#define __channel_rfd(s, side) ((s)->efds[((side) << 1)])
+
+#define __channel_wfd(s, side) ((s)->efds[((side) << 1) + 1])
+
+
+static inline void
+__channel_ring_bell(int efd)
+{
+    uint64_t one = 1;
+
+    // EAGAIN means the counter is about to overflow, the peer is awake anyway
+    write(efd, &one, sizeof(one));
+}
+
+
+static inline void
+__channel_ring_drain(int efd)
+{
+    uint64_t value = 0;
+
+    read(efd, &value, sizeof(value));
+}
+
+
+static inline Channel *
+__channel_alloc(PyTypeObject *type)
+{
+    Channel *self = NULL;
+
+    if ((self = PyObject_New(Channel, type))) {
+        self->fd = -1;
+        self->efds[0] = self->efds[1] = self->efds[2] = self->efds[3] = -1;
+        self->side = 0;
+        self->full = 0;
+        self->size = 0;
+        self->len = 0;
+        self->map = NULL;
+    }
+    return self;
+}
+
+
+static inline int
+__channel_map(Channel *self)
+{
+    if ((self->map = mmap(NULL, self->len, (PROT_READ | PROT_WRITE),
+                          MAP_SHARED, self->fd, 0)) == MAP_FAILED) {
+        self->map = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+
+static inline int
+__channel_create(Channel *self, Py_ssize_t size)
+{
+    self->side = 0;
+    self->size = size;
+    self->len = (2 * sizeof(ChannelRing)) + (2 * self->size);
+    // sealed so that the peer can not shrink it under our feet (SIGBUS)
+    if (
+        ((self->fd = memfd_create("ippc", (MFD_CLOEXEC | MFD_ALLOW_SEALING))) == -1) ||
+        ftruncate(self->fd, self->len) ||
+        fcntl(self->fd, F_ADD_SEALS, CHANNEL_SEALS) ||
+        ((self->efds[0] = eventfd(0, CHANNEL_EFD_FLAGS)) == -1) ||
+        ((self->efds[1] = eventfd(0, CHANNEL_EFD_FLAGS)) == -1) ||
+        ((self->efds[2] = eventfd(0, CHANNEL_EFD_FLAGS)) == -1) ||
+        ((self->efds[3] = eventfd(0, CHANNEL_EFD_FLAGS)) == -1) ||
+        __channel_map(self)
+       ) {
+        _PyErr_SetFromErrno();
+        return -1;
+    }
+    // both consumers start idle, the first write rings the doorbell
+    __channel_ring(self, 0)->rwait = __channel_ring(self, 1)->rwait = 1;
+    return 0;
+}
+
+
+static inline int
+__channel_attach(Channel *self, PyObject *fds)
+{
+    struct stat st;
+    PyObject *seq = NULL;
+    int _fds_[5] = { -1, -1, -1, -1, -1 }, seals = 0;
+    Py_ssize_t i, n = 0;
+
+    if (!(seq = PySequence_Fast(fds, "fds must be a sequence"))) {
+        return -1;
+    }
+    // we own the descriptors from now on, even on failure
+    n = Py_MIN(PySequence_Fast_GET_SIZE(seq), 5);
+    for (i = 0; i < n; i++) {
+        if ((_fds_[i] =
+             PyObject_AsFileDescriptor(PySequence_Fast_GET_ITEM(seq, i))) == -1) {
+            break;
+        }
+    }
+    self->side = 1;
+    self->fd = _fds_[0];
+    memcpy(self->efds, (_fds_ + 1), sizeof(self->efds));
+    if (PyErr_Occurred()) {
+        Py_DECREF(seq);
+        return -1;
+    }
+    if ((PySequence_Fast_GET_SIZE(seq) != 5) || (n != 5)) {
+        Py_DECREF(seq);
+        PyErr_SetString(PyExc_ValueError, "Invalid fds");
+        return -1;
+    }
+    Py_DECREF(seq);
+    if (fstat(self->fd, &st) || ((seals = fcntl(self->fd, F_GET_SEALS)) == -1)) {
+        _PyErr_SetFromErrno();
+        return -1;
+    }
+    self->len = st.st_size;
+    self->size = (self->len > (2 * sizeof(ChannelRing))) ?
+        ((self->len - (2 * sizeof(ChannelRing))) >> 1) : 0;
+    if (
+        ((seals & CHANNEL_SEALS) != CHANNEL_SEALS) ||
+        (self->size < 4096) || (self->size & (self->size - 1)) ||
+        (self->len != ((2 * sizeof(ChannelRing)) + (2 * self->size)))
+       ) {
+        PyErr_SetString(PyExc_ValueError, "Invalid channel");
+        return -1;
+    }
+    if (__channel_map(self)) {
+        _PyErr_SetFromErrno();
+        return -1;
+    }
+    return 0;
+}
+
+
+static inline int
+__channel_init(Channel *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"size", "fds", NULL};
+    Py_ssize_t size = CHANNEL_SIZE;
+    PyObject *fds = NULL;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|$nO:__new__", kwlist,
+                                     &size, &fds)) {
+        return -1;
+    }
+    if (fds && (fds != Py_None)) {
+        return __channel_attach(self, fds);
+    }
+    if ((size < 4096) || (size & (size - 1))) {
+        PyErr_SetString(PyExc_ValueError, "Invalid size");
+        return -1;
+    }
+    return __channel_create(self, size);
+}
+
+
+static inline int
+__channel_close(Channel *self)
+{
+    int res = 0, i;
+
+    if (self->map) {
+        munmap(self->map, self->len);
+        self->map = NULL;
+    }
+    for (i = 0; i < 4; i++) {
+        if (self->efds[i] != -1) {
+            close(self->efds[i]);
+            self->efds[i] = -1;
+        }
+    }
+    if (self->fd != -1) {
+        if ((res = close(self->fd))) {
+            _PyErr_SetFromErrno();
+        }
+        self->fd = -1;
+    }
+    return res;
+}
+
+
+static inline int
+__channel_check(Channel *self)
+{
+    if (!self->map) {
+        PyErr_SetString(PyExc_ValueError, "I/O operation on closed channel");
+        return -1;
+    }
+    return 0;
+}
+
+
+/* Channel_Type ------------------------------------------------------------- */
+
+/* Channel_Type.tp_new */
+static PyObject *
+Channel_tp_new(PyTypeObject *type, PyObject *args, PyObject *kwargs)
+{
+    Channel *self = NULL;
+
+    if ((self = __channel_alloc(type)) && __channel_init(self, args, kwargs)) {
+        Py_CLEAR(self);
+    }
+    return (PyObject *)self;
+}
+
+
+/* Channel_Type.tp_dealloc */
+static void
+Channel_tp_dealloc(Channel *self)
+{
+    if (PyObject_CallFinalizerFromDealloc((PyObject *)self)) {
+        return;
+    }
+    PyObject_Del(self);
+}
+
+
+/* Channel_Type.tp_repr */
+static PyObject *
+Channel_tp_repr(Channel *self)
+{
+    return PyUnicode_FromFormat(
+        "<%s(fd=%d, size=%zu)>", Py_TYPE(self)->tp_name, self->fd, self->size);
+}
+
+
+/* Channel.write(buf) */
+PyDoc_STRVAR(Channel_write_doc,
+"write(buf)");
+
+static int
+__channel_send(Channel *self, PyByteArrayObject *buf)
+{
+    ChannelRing *ring = NULL;
+    char *data = NULL;
+    uint64_t head = 0, tail = 0;
+    size_t len = 0, room = 0, offset = 0, size = 0;
+
+    if (__channel_check(self)) {
+        return -1;
+    }
+    ring = __channel_ring(self, self->side);
+    data = __channel_data(self, self->side);
+    if (self->full) {
+        __channel_ring_drain(__channel_wfd(self, self->side));
+        self->full = 0;
+    }
+    tail = ring->tail; // we are the only producer
+    len = Py_SIZE(buf);
+    while (len) {
+        head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (!(room = self->size - (tail - head))) {
+            // full, the consumer rings our doorbell once it made room
+            __atomic_store_n(&ring->wwait, 1, __ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) == head) {
+                self->full = 1;
+                break;
+            }
+            continue;
+        }
+        offset = tail & (self->size - 1);
+        size = Py_MIN(Py_MIN(len, room), (self->size - offset));
+        memcpy((data + offset), buf->ob_start, size);
+        tail += size;
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+        // XXX: very bad shortcut ¯\_(ツ)_/¯
+        buf->ob_start += size;
+        len = __buf_terminate(buf, (len - size));
+    }
+    // only wake the consumer up if it went idle
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->rwait, __ATOMIC_RELAXED) &&
+        __atomic_exchange_n(&ring->rwait, 0, __ATOMIC_SEQ_CST)) {
+        __channel_ring_bell(__channel_rfd(self, !self->side));
+    }
+    return 0;
+}
+
+
+static PyObject *
+Channel_write(Channel *self, PyObject *args)
+{
+    PyByteArrayObject *buf = NULL;
+
+    if (!PyArg_ParseTuple(args, "Y:write", &buf) || __channel_send(self, buf)) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+
+/* Channel.read(buf) */
+PyDoc_STRVAR(Channel_read_doc,
+"read(buf) -> bool");
+
+static int
+__channel_recv(Channel *self, PyByteArrayObject *buf)
+{
+    ChannelRing *ring = NULL;
+    char *data = NULL;
+    uint64_t head = 0, tail = 0;
+    size_t len = 0, size = 0, offset = 0, chunk = 0;
+
+    if (__channel_check(self)) {
+        return -1;
+    }
+    ring = __channel_ring(self, !self->side);
+    data = __channel_data(self, !self->side);
+    head = ring->head; // we are the only consumer
+    len = Py_SIZE(buf);
+    for (;;) {
+        tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        if ((size = tail - head)) {
+            if (size > self->size) {
+                PyErr_SetString(PyExc_ValueError, "Corrupted channel");
+                return -1;
+            }
+            if (__buf_resize(buf, (len + size))) {
+                return -1;
+            }
+            offset = head & (self->size - 1);
+            chunk = Py_MIN(size, (self->size - offset));
+            memcpy((buf->ob_start + len), (data + offset), chunk);
+            memcpy((buf->ob_start + len + chunk), data, (size - chunk));
+            len = __buf_terminate(buf, (len + size));
+            head = tail;
+            __atomic_store_n(&ring->head, head, __ATOMIC_SEQ_CST);
+            // the store to head is visible before wwait is read (store-load
+            // ordering), as on the write side
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&ring->wwait, __ATOMIC_RELAXED) &&
+                __atomic_exchange_n(&ring->wwait, 0, __ATOMIC_SEQ_CST)) {
+                __channel_ring_bell(__channel_wfd(self, !self->side));
+            }
+        }
+        // going idle, ask for a doorbell and look again; the doorbell only
+        // rang if the producer took the last request, silence it first
+        if (!__atomic_load_n(&ring->rwait, __ATOMIC_ACQUIRE)) {
+            __channel_ring_drain(__channel_rfd(self, self->side));
+            __atomic_store_n(&ring->rwait, 1, __ATOMIC_SEQ_CST);
+        }
+        if (__atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) == head) {
+            break;
+        }
+    }
+    return 0;
+}
+
+
+static PyObject *
+Channel_read(Channel *self, PyObject *args)
+{
+    PyByteArrayObject *buf = NULL;
+
+    if (!PyArg_ParseTuple(args, "Y:read", &buf) || __channel_recv(self, buf)) {
+        return NULL;
+    }
+    Py_RETURN_FALSE;
+}
+
+
+/* Channel.fds() */
+PyDoc_STRVAR(Channel_fds_doc,
+"fds() -> (int, int, int, int, int)");
+
+static PyObject *
+Channel_fds(Channel *self)
+{
+    return (__channel_check(self)) ? NULL :
+        Py_BuildValue("(iiiii)", self->fd, self->efds[0], self->efds[1],
+                      self->efds[2], self->efds[3]);
+}
+
+
+/* Channel.close() */
+PyDoc_STRVAR(Channel_close_doc,
+"close()");
+
+static PyObject *
+Channel_close(Channel *self)
+{
+    return (__channel_close(self)) ? NULL : __Py_INCREF(Py_None);
+}
+
+
+/* Channel.fileno() */
+PyDoc_STRVAR(Channel_fileno_doc,
+"fileno() -> int");
+
+static PyObject *
+Channel_fileno(Channel *self)
+{
+    return PyLong_FromLong(__channel_rfd(self, self->side));
+}
+
+
+/* Channel.wfileno() */
+PyDoc_STRVAR(Channel_wfileno_doc,
+"wfileno() -> int");
+
+static PyObject *
+Channel_wfileno(Channel *self)
+{
+    return PyLong_FromLong(__channel_wfd(self, self->side));
+}
+
+
+/* Channel_Type.tp_methods */
+static PyMethodDef Channel_tp_methods[] = {
+    {"write", (PyCFunction)Channel_write, METH_VARARGS, Channel_write_doc},
+    {"read", (PyCFunction)Channel_read, METH_VARARGS, Channel_read_doc},
+    {"fds", (PyCFunction)Channel_fds, METH_NOARGS, Channel_fds_doc},
+    {"close", (PyCFunction)Channel_close, METH_NOARGS, Channel_close_doc},
+    {"fileno", (PyCFunction)Channel_fileno, METH_NOARGS, Channel_fileno_doc},
+    {"wfileno", (PyCFunction)Channel_wfileno, METH_NOARGS, Channel_wfileno_doc},
+    {NULL}  /* Sentinel */
+};
+
+
+/* Channel.closed */
+static PyObject *
+Channel_closed_get(Channel *self, void *closure)
+{
+    return PyBool_FromLong((self->map == NULL));
+}
+
+
+/* Channel.size */
+static PyObject *
+Channel_size_get(Channel *self, void *closure)
+{
+    return PyLong_FromSize_t(self->size);
+}
+
+
+/* Channel_Type.tp_getset */
+static PyGetSetDef Channel_tp_getset[] = {
+    {"closed", (getter)Channel_closed_get, _Py_READONLY_ATTRIBUTE, NULL, NULL},
+    {"size", (getter)Channel_size_get, _Py_READONLY_ATTRIBUTE, NULL, NULL},
+    {NULL}  /* Sentinel */
+};
+
+
+/* Channel_Type.tp_finalize */
+static void
+Channel_tp_finalize(Channel *self)
+{
+    PyObject *exc_type, *exc_value, *exc_traceback;
+
+    PyErr_Fetch(&exc_type, &exc_value, &exc_traceback);
+    if (__channel_close(self)) {
+        PyErr_WriteUnraisable((PyObject *)self);
+    }
+    PyErr_Restore(exc_type, exc_value, exc_traceback);
+}
+
+
+static PyTypeObject Channel_Type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "mood.ippc.sockets.Channel",
+    .tp_basicsize = sizeof(Channel),
+    .tp_dealloc = (destructor)Channel_tp_dealloc,
+    .tp_repr = (reprfunc)Channel_tp_repr,
+    .tp_flags = (Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_FINALIZE),
+    .tp_methods = Channel_tp_methods,
+    .tp_getset = Channel_tp_getset,
+    .tp_finalize = (destructor)Channel_tp_finalize,
+    .tp_new = Channel_tp_new,
+};
+
+
+/* --------------------------------------------------------------------------
+   Ring
+   -------------------------------------------------------------------------- */
+
+#ifdef HAVE_IO_URING
+
+#define RING_BGID 0
+
+/* room left in each provided buffer, in front of the data, for what a
+   recvmsg on a unix socket gets along (descriptors of memfd frames) */
+#define RING_CONTROL CMSG_SPACE(sizeof(int) * SOCK_MAXFDS)
+#define RING_MSG_HEADER (sizeof(struct io_uring_recvmsg_out) + RING_CONTROL)
+
+#define __ring_load(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define __ring_store(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+
+enum {
+    RING_ACCEPT = 1,
+    RING_RECV,
+    RING_SEND,
+};
+
+
+/* an in flight operation, user_data points back to it */
+typedef struct _RingRequest {
+    struct _RingRequest *prev;
+    struct _RingRequest *next;
+    int op;
+    Abstract *socket;
+    PyObject *buf;
+    PyObject *callback;
+    int resume; // rearm instead of dropping the request once cancelled
+    struct msghdr msg; // recvmsg template, unix sockets only
+} RingRequest;
+
+
+/* Ring */
+typedef struct {
+    PyObject_HEAD
+    int fd;
+    int efd;
+    unsigned entries;
+    // submission queue
+    void *sq_ptr;
+    size_t sq_len;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_flags;
+    unsigned *sq_array;
+    unsigned sqe_tail;
+    struct io_uring_sqe *sqes;
+    size_t sqes_len;
+    // completion queue
+    void *cq_ptr;
+    size_t cq_len;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    // provided buffers
+    struct io_uring_buf_ring *br;
+    size_t br_len;
+    unsigned short br_tail;
+    char *bufs;
+    size_t bufs_len;
+    unsigned nbufs;
+    unsigned bufsize;
+    // in flight requests
+    RingRequest requests;
+} Ring;
+
+
+static inline int
+__io_uring_setup(unsigned entries, struct io_uring_params *params)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+
+static inline int
+__io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                 unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                        flags, NULL, 0);
+}
+
+
+static inline int
+__io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+
+static inline void *
+__ring_mmap(int fd, size_t len, off_t offset)
+{
+    void *ptr = NULL;
+
+    ptr = mmap(NULL, len, (PROT_READ | PROT_WRITE),
+               ((fd == -1) ? (MAP_PRIVATE | MAP_ANONYMOUS) : MAP_SHARED) | MAP_POPULATE,
+               fd, offset);
+    return (ptr == MAP_FAILED) ? NULL : ptr;
+}
+
+
+static inline void
+__ring_munmap(void **ptr, size_t len)
+{
+    if (*ptr) {
+        munmap(*ptr, len);
+        *ptr = NULL;
+    }
+}
+
+
+/* requests ----------------------------------------------------------------- */
+
+static inline RingRequest *
+__ring_request_new(Ring *self, int op, Abstract *socket, PyObject *buf,
+                   PyObject *callback)
+{
+    RingRequest *req = NULL;
+
+    if (!(req = PyMem_Malloc(sizeof(RingRequest)))) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+    req->op = op;
+    req->socket = (Abstract *)__Py_INCREF((PyObject *)socket);
+    req->buf = (buf) ? __Py_INCREF(buf) : NULL;
+    req->callback = __Py_INCREF(callback);
+    req->resume = 0;
+    memset(&req->msg, 0, sizeof(struct msghdr));
+    if ((op == RING_RECV) && (socket->family == AF_UNIX)) {
+        req->msg.msg_controllen = RING_CONTROL;
+    }
+    else if (op == RING_SEND) {
+        // the kernel reads straight from the buffer, pin it until the
+        // request is gone (resizing raises BufferError meanwhile)
+        ((PyByteArrayObject *)buf)->ob_exports++;
+    }
+    req->prev = &self->requests;
+    req->next = self->requests.next;
+    req->next->prev = req;
+    self->requests.next = req;
+    return req;
+}
+
+
+static inline void
+__ring_request_del(RingRequest *req)
+{
+    req->prev->next = req->next;
+    req->next->prev = req->prev;
+    if (req->op == RING_SEND) {
+        ((PyByteArrayObject *)req->buf)->ob_exports--;
+    }
+    Py_DECREF(req->socket);
+    Py_XDECREF(req->buf);
+    Py_DECREF(req->callback);
+    PyMem_Free(req);
+}
+
+
+/* submission --------------------------------------------------------------- */
+
+static int
+__ring_submit(Ring *self)
+{
+    unsigned pending = 0;
+    int res = 0;
+
+    __ring_store(self->sq_tail, self->sqe_tail);
+    if ((pending = (self->sqe_tail - __ring_load(self->sq_head)))) {
+        do {
+            res = __io_uring_enter(self->fd, pending, 0, 0);
+        } while ((res == -1) && (errno == EINTR));
+        if ((res == -1) && ((errno == EAGAIN) || (errno == EBUSY))) {
+            res = 0; // the kernel is short on resources, retry later
+        }
+    }
+    return (res == -1) ? -1 : 0;
+}
+
+
+/* completions that did not fit in the CQ are held back by the kernel until
+   asked for them, returns 1 if there are more to reap */
+static int
+__ring_flush(Ring *self)
+{
+    int res = 0;
+
+    if (!(__ring_load(self->sq_flags) & IORING_SQ_CQ_OVERFLOW)) {
+        return 0;
+    }
+    do {
+        res = __io_uring_enter(self->fd, 0, 0, IORING_ENTER_GETEVENTS);
+    } while ((res == -1) && (errno == EINTR));
+    if (res == -1) {
+        return -1;
+    }
+    return (*self->cq_head != __ring_load(self->cq_tail));
+}
+
+
+static struct io_uring_sqe *
+__ring_sqe(Ring *self)
+{
+    struct io_uring_sqe *sqe = NULL;
+    unsigned index = 0;
+
+    if (((self->sqe_tail - __ring_load(self->sq_head)) >= self->entries) &&
+        (__ring_submit(self) ||
+         ((self->sqe_tail - __ring_load(self->sq_head)) >= self->entries))) {
+        if (!errno) {
+            errno = EBUSY;
+        }
+        return NULL;
+    }
+    index = self->sqe_tail & *self->sq_mask;
+    sqe = &self->sqes[index];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    self->sq_array[index] = index;
+    self->sqe_tail++;
+    return sqe;
+}
+
+
+static int
+__ring_prep(Ring *self, RingRequest *req)
+{
+    struct io_uring_sqe *sqe = NULL;
+    PyByteArrayObject *buf = NULL;
+
+    if (req->socket->fd == -1) {
+        errno = EBADF;
+        return -1;
+    }
+    if (!(sqe = __ring_sqe(self))) {
+        return -1;
+    }
+    sqe->fd = req->socket->fd;
+    sqe->user_data = (uint64_t)(uintptr_t)req;
+    switch (req->op) {
+        case RING_ACCEPT:
+            sqe->opcode = IORING_OP_ACCEPT;
+            sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+            sqe->accept_flags = SOCK_FLAGS;
+            break;
+        case RING_RECV:
+            // descriptors only come along with recvmsg
+            if (req->msg.msg_controllen) {
+                sqe->opcode = IORING_OP_RECVMSG;
+                sqe->addr = (uint64_t)(uintptr_t)&req->msg;
+                sqe->msg_flags = MSG_CMSG_CLOEXEC;
+            }
+            else {
+                sqe->opcode = IORING_OP_RECV;
+            }
+            sqe->ioprio = IORING_RECV_MULTISHOT;
+            sqe->flags = IOSQE_BUFFER_SELECT;
+            sqe->buf_group = RING_BGID;
+            break;
+        case RING_SEND:
+            buf = (PyByteArrayObject *)req->buf;
+            sqe->opcode = IORING_OP_SEND;
+            sqe->addr = (uint64_t)(uintptr_t)buf->ob_start;
+            sqe->len = (unsigned)Py_MIN(Py_SIZE(buf), INT_MAX);
+            sqe->msg_flags = MSG_NOSIGNAL;
+            break;
+    }
+    return 0;
+}
+
+
+static inline int
+__ring_cancel(Ring *self, Abstract *socket)
+{
+    struct io_uring_sqe *sqe = NULL;
+    RingRequest *req = NULL;
+
+    for (req = self->requests.next; req != &self->requests; req = req->next) {
+        if (req->socket == socket) {
+            req->resume = 0;
+        }
+    }
+    if (!(sqe = __ring_sqe(self))) {
+        return -1;
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = socket->fd;
+    sqe->cancel_flags = (IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL);
+    sqe->user_data = 0;
+    // submit right away, the fd is about to be closed (and reused)
+    return __ring_submit(self);
+}
+
+
+/* cancel a single request, its last completion still comes through */
+static inline int
+__ring_cancel_request(Ring *self, RingRequest *req)
+{
+    struct io_uring_sqe *sqe = NULL;
+
+    if (!(sqe = __ring_sqe(self))) {
+        return -1;
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = (uint64_t)(uintptr_t)req;
+    sqe->user_data = 0;
+    return 0;
+}
+
+
+/* provided buffers --------------------------------------------------------- */
+
+static inline void
+__ring_buf_recycle(Ring *self, unsigned short bid)
+{
+    struct io_uring_buf *buf = &self->br->bufs[self->br_tail & (self->nbufs - 1)];
+
+    buf->addr = (uint64_t)(uintptr_t)(self->bufs + ((size_t)bid * self->bufsize));
+    buf->len = self->bufsize;
+    buf->bid = bid;
+    __ring_store(&self->br->tail, ++self->br_tail);
+}
+
+
+/* completion --------------------------------------------------------------- */
+
+static inline PyObject *
+__ring_error(int err)
+{
+    return PyObject_CallFunction(PyExc_OSError, "is", err, strerror(err));
+}
+
+
+/* queue (callback, value) in result; a NULL value reports the pending
+   exception to callback instead, a failure of one request is not a failure
+   of the whole reap */
+static inline int
+__ring_report(PyObject *result, PyObject *callback, PyObject *value)
+{
+    PyObject *item = NULL;
+    int res = -1;
+
+    if (!value && PyErr_Occurred()) {
+        value = __exception();
+    }
+    if (value && (item = PyTuple_Pack(2, callback, value))) {
+        res = PyList_Append(result, item);
+        Py_DECREF(item);
+    }
+    Py_XDECREF(value);
+    return res;
+}
+
+
+static inline int
+__ring_rearm(Ring *self, RingRequest *req)
+{
+    if ((req->socket->fd == -1) || __ring_prep(self, req)) {
+        __ring_request_del(req);
+    }
+    return 0;
+}
+
+
+static int
+__ring_accept(Ring *self, RingRequest *req, struct io_uring_cqe *cqe,
+              PyObject *result)
+{
+    PyObject *value = NULL;
+
+    if (cqe->res == -ECANCELED) {
+        __ring_request_del(req);
+        return 0;
+    }
+    value = (cqe->res < 0) ?
+        __ring_error(-cqe->res) :
+        (PyObject *)__socket_accepted(req->socket, cqe->res);
+    if (__ring_report(result, req->callback, value)) {
+        return -1;
+    }
+    return (cqe->flags & IORING_CQE_F_MORE) ? 0 : __ring_rearm(self, req);
+}
+
+
+/* move data past what a multishot recvmsg put in front of the payload, the
+   descriptors sent along are queued, see recvfds() */
+static inline int
+__ring_recvmsg(RingRequest *req, char **data, Py_ssize_t *size)
+{
+    struct io_uring_recvmsg_out *out = (struct io_uring_recvmsg_out *)*data;
+    Py_ssize_t hlen = sizeof(struct io_uring_recvmsg_out) +
+                      req->msg.msg_namelen + req->msg.msg_controllen;
+    struct msghdr msg = {
+        .msg_control = (*data + sizeof(struct io_uring_recvmsg_out) +
+                        req->msg.msg_namelen),
+        .msg_controllen = out->controllen
+    };
+    struct cmsghdr *cmsg = NULL;
+
+    if (*size < hlen) {
+        errno = EPROTO;
+        return -1;
+    }
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if ((cmsg->cmsg_level == SOL_SOCKET) &&
+            (cmsg->cmsg_type == SCM_RIGHTS) &&
+            __fds_push(req->socket, (int *)CMSG_DATA(cmsg),
+                       ((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int)))) {
+            return -1;
+        }
+    }
+    if (out->flags & MSG_CTRUNC) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    *data += hlen;
+    *size = Py_MIN((Py_ssize_t)out->payloadlen, (*size - hlen));
+    return 0;
+}
+
+
+static int
+__ring_recv(Ring *self, RingRequest *req, struct io_uring_cqe *cqe,
+            PyObject *result)
+{
+    PyByteArrayObject *buf = (PyByteArrayObject *)req->buf;
+    Py_ssize_t len = Py_SIZE(buf), size = cqe->res;
+    unsigned short bid = 0;
+    char *data = NULL;
+    int res = 0;
+
+    if (size > 0) {
+        bid = (unsigned short)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+        data = self->bufs + ((size_t)bid * self->bufsize);
+        if (req->msg.msg_controllen && __ring_recvmsg(req, &data, &size)) {
+            _PyErr_SetFromErrno();
+            res = -1;
+        }
+        else if (size && !(res = __buf_resize(buf, (len + size)))) {
+            memcpy((buf->ob_start + len), data, size);
+            __buf_terminate(buf, (len + size));
+        }
+        __ring_buf_recycle(self, bid);
+        // a failure is reported to this connection only, a recvmsg eof is
+        // an empty payload
+        if (__ring_report(result, req->callback,
+                          (res) ? NULL : PyLong_FromSsize_t(size))) {
+            return -1;
+        }
+    }
+    else if (size == 0) {
+        // eof
+        if (__ring_report(result, req->callback, PyLong_FromLong(0))) {
+            return -1;
+        }
+    }
+    else if (size == -ENOBUFS) {
+        // out of provided buffers, the multishot recv needs to be rearmed
+        return __ring_rearm(self, req);
+    }
+    else if (size != -ECANCELED) {
+        if (__ring_report(result, req->callback, __ring_error(-size))) {
+            return -1;
+        }
+    }
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        if (((size > 0) && !res) || ((size == -ECANCELED) && req->resume)) {
+            req->resume = 0;
+            return __ring_rearm(self, req);
+        }
+        __ring_request_del(req);
+    }
+    return 0;
+}
+
+
+static int
+__ring_send(Ring *self, RingRequest *req, struct io_uring_cqe *cqe,
+            PyObject *result)
+{
+    PyByteArrayObject *buf = (PyByteArrayObject *)req->buf;
+    PyObject *value = NULL;
+
+    if (cqe->res >= 0) {
+        buf->ob_start += cqe->res;
+        if (__buf_terminate(buf, (Py_SIZE(buf) - cqe->res))) {
+            // partial send, queue the remainder
+            if (!__ring_prep(self, req)) {
+                return 0;
+            }
+            value = __ring_error(errno);
+        }
+        else {
+            value = __Py_INCREF(Py_None);
+        }
+    }
+    else if (cqe->res != -ECANCELED) {
+        value = __ring_error(-cqe->res);
+    }
+    if (value && __ring_report(result, req->callback, value)) {
+        __ring_request_del(req);
+        return -1;
+    }
+    __ring_request_del(req);
+    return 0;
+}
+
+
+static int
+__ring_complete(Ring *self, struct io_uring_cqe *cqe, PyObject *result)
+{
+    RingRequest *req = (RingRequest *)(uintptr_t)cqe->user_data;
+    int res = 0;
+
+    if (req) { // cancellations are posted with a NULL user_data
+        switch (req->op) {
+            case RING_ACCEPT:
+                res = __ring_accept(self, req, cqe, result);
+                break;
+            case RING_RECV:
+                res = __ring_recv(self, req, cqe, result);
+                break;
+            case RING_SEND:
+                res = __ring_send(self, req, cqe, result);
+                break;
+        }
+    }
+    return res;
+}
+
+
+static PyObject *
+__ring_reap(Ring *self)
+{
+    PyObject *result = NULL;
+    struct io_uring_cqe *cqe = NULL;
+    unsigned head = 0;
+    eventfd_t value = 0;
+    int res = 0;
+
+    if (eventfd_read(self->efd, &value) && (errno != EAGAIN)) {
+        return _PyErr_SetFromErrno();
+    }
+    if ((result = PyList_New(0))) {
+        do {
+            for (head = *self->cq_head;
+                 head != __ring_load(self->cq_tail);
+                 head++) {
+                cqe = &self->cqes[head & *self->cq_mask];
+                if (__ring_complete(self, cqe, result)) {
+                    __ring_store(self->cq_head, (head + 1));
+                    Py_CLEAR(result);
+                    return NULL;
+                }
+            }
+            __ring_store(self->cq_head, head);
+        } while ((res = __ring_flush(self)) > 0);
+        if (res || __ring_submit(self)) {
+            Py_CLEAR(result);
+            return _PyErr_SetFromErrno();
+        }
+    }
+    return result;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+static inline Ring *
+__ring_alloc(PyTypeObject *type)
+{
+    Ring *self = NULL;
+
+    if ((self = PyObject_GC_NEW(Ring, type))) {
+        memset(((char *)self + sizeof(PyObject)), 0,
+               (sizeof(Ring) - sizeof(PyObject)));
+        self->fd = -1;
+        self->efd = -1;
+        self->requests.prev = self->requests.next = &self->requests;
+        PyObject_GC_Track(self);
+    }
+    return self;
+}
+
+
+static inline int
+__ring_setup(Ring *self, unsigned entries)
+{
+    struct io_uring_params params;
+
+    memset(&params, 0, sizeof(params));
+    params.flags = (IORING_SETUP_CLAMP | IORING_SETUP_SUBMIT_ALL);
+    if ((self->fd = __io_uring_setup(entries, &params)) == -1) {
+        return -1;
+    }
+    self->entries = params.sq_entries;
+    self->sq_len = params.sq_off.array + (params.sq_entries * sizeof(unsigned));
+    self->cq_len = params.cq_off.cqes +
+                   (params.cq_entries * sizeof(struct io_uring_cqe));
+    self->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        self->sq_len = self->cq_len = Py_MAX(self->sq_len, self->cq_len);
+    }
+    if (
+        !(self->sq_ptr = __ring_mmap(self->fd, self->sq_len, IORING_OFF_SQ_RING)) ||
+        !(self->cq_ptr = (params.features & IORING_FEAT_SINGLE_MMAP) ?
+          self->sq_ptr :
+          __ring_mmap(self->fd, self->cq_len, IORING_OFF_CQ_RING)) ||
+        !(self->sqes = __ring_mmap(self->fd, self->sqes_len, IORING_OFF_SQES))
+       ) {
+        return -1;
+    }
+    self->sq_head = self->sq_ptr + params.sq_off.head;
+    self->sq_tail = self->sq_ptr + params.sq_off.tail;
+    self->sq_mask = self->sq_ptr + params.sq_off.ring_mask;
+    self->sq_flags = self->sq_ptr + params.sq_off.flags;
+    self->sq_array = self->sq_ptr + params.sq_off.array;
+    self->sqe_tail = *self->sq_tail;
+    self->cq_head = self->cq_ptr + params.cq_off.head;
+    self->cq_tail = self->cq_ptr + params.cq_off.tail;
+    self->cq_mask = self->cq_ptr + params.cq_off.ring_mask;
+    self->cqes = self->cq_ptr + params.cq_off.cqes;
+    // completions are signalled through a single eventfd
+    if (
+        ((self->efd = eventfd(0, (EFD_CLOEXEC | EFD_NONBLOCK))) == -1) ||
+        __io_uring_register(self->fd, IORING_REGISTER_EVENTFD, &self->efd, 1)
+       ) {
+        return -1;
+    }
+    return 0;
+}
+
+
+static inline int
+__ring_setup_buffers(Ring *self, unsigned nbufs, unsigned bufsize)
+{
+    struct io_uring_buf_reg reg;
+    unsigned i;
+
+    self->nbufs = nbufs;
+    self->bufsize = bufsize;
+    self->br_len = nbufs * sizeof(struct io_uring_buf);
+    self->bufs_len = (size_t)nbufs * bufsize;
+    if (
+        !(self->br = __ring_mmap(-1, self->br_len, 0)) ||
+        !(self->bufs = __ring_mmap(-1, self->bufs_len, 0))
+       ) {
+        return -1;
+    }
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)self->br;
+    reg.ring_entries = nbufs;
+    reg.bgid = RING_BGID;
+    if (__io_uring_register(self->fd, IORING_REGISTER_PBUF_RING, &reg, 1)) {
+        return -1;
+    }
+    for (i = 0; i < nbufs; i++) {
+        __ring_buf_recycle(self, i);
+    }
+    return 0;
+}
+
+
+static inline int
+__ring_init(Ring *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"entries", "buffers", "bufsize", NULL};
+    unsigned int entries = 256, nbufs = 256, bufsize = 65536;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|$III:__new__", kwlist,
+                                     &entries, &nbufs, &bufsize)) {
+        return -1;
+    }
+    if (!entries || !nbufs || (nbufs > 32768) || (nbufs & (nbufs - 1))) {
+        PyErr_SetString(PyExc_ValueError,
+                        "buffers must be a power of 2 (max: 32768)");
+        return -1;
+    }
+    if ((bufsize <= RING_MSG_HEADER) || (bufsize > INT_MAX)) {
+        PyErr_SetString(PyExc_ValueError, "Invalid buffer size");
+        return -1;
+    }
+    if (__ring_setup(self, entries) ||
+        __ring_setup_buffers(self, nbufs, bufsize)) {
+        _PyErr_SetFromErrno();
+        return -1;
+    }
+    return 0;
+}
+
+
+static inline void
+__ring_clear(Ring *self)
+{
+    while (self->requests.next != &self->requests) {
+        __ring_request_del(self->requests.next);
+    }
+}
+
+
+/* cancel everything in flight and wait until the kernel is done with it,
+   completions are dropped on the floor */
+static int
+__ring_drain(Ring *self)
+{
+    struct io_uring_cqe *cqe = NULL;
+    RingRequest *req = NULL;
+    unsigned head = 0;
+    int res = 0;
+
+    for (req = self->requests.next; req != &self->requests; req = req->next) {
+        if (__ring_cancel_request(self, req)) {
+            return -1;
+        }
+    }
+    if (__ring_submit(self)) {
+        return -1;
+    }
+    while (self->requests.next != &self->requests) {
+        res = __io_uring_enter(self->fd, 0, 1, IORING_ENTER_GETEVENTS);
+        if ((res == -1) && (errno != EINTR)) {
+            return -1;
+        }
+        for (head = *self->cq_head;
+             head != __ring_load(self->cq_tail);
+             head++) {
+            cqe = &self->cqes[head & *self->cq_mask];
+            if (
+                (req = (RingRequest *)(uintptr_t)cqe->user_data) &&
+                !(cqe->flags & IORING_CQE_F_MORE)
+               ) {
+                __ring_request_del(req);
+            }
+        }
+        __ring_store(self->cq_head, head);
+    }
+    return 0;
+}
+
+
+static inline int
+__ring_close(Ring *self)
+{
+    int res = 0, drained = 1;
+
+    if (self->fd != -1) {
+        drained = !__ring_drain(self);
+        __ring_munmap((void **)&self->sqes, self->sqes_len);
+        if (self->cq_ptr != self->sq_ptr) {
+            __ring_munmap(&self->cq_ptr, self->cq_len);
+        }
+        self->cq_ptr = NULL;
+        __ring_munmap(&self->sq_ptr, self->sq_len);
+        if ((res = close(self->fd))) {
+            _PyErr_SetFromErrno();
+        }
+        self->fd = -1;
+    }
+    if (self->efd != -1) {
+        close(self->efd);
+        self->efd = -1;
+    }
+    // the kernel may still write into the provided buffers if it did not let
+    // go of every request, better leak them than have them reused
+    if (drained) {
+        __ring_munmap((void **)&self->bufs, self->bufs_len);
+        __ring_munmap((void **)&self->br, self->br_len);
+    }
+    __ring_clear(self);
+    return res;
+}
+
+
+static inline int
+__ring_check(Ring *self)
+{
+    if (self->fd == -1) {
+        PyErr_SetString(PyExc_ValueError, "I/O operation on closed ring");
+        return -1;
+    }
+    return 0;
+}
+
+
+static inline PyObject *
+__ring_queue(Ring *self, int op, Abstract *socket, PyObject *buf,
+             PyObject *callback)
+{
+    RingRequest *req = NULL;
+
+    if (__ring_check(self)) {
+        return NULL;
+    }
+    if (!PyCallable_Check(callback)) {
+        PyErr_SetString(PyExc_TypeError, "callback must be callable");
+        return NULL;
+    }
+    if (!(req = __ring_request_new(self, op, socket, buf, callback))) {
+        return NULL;
+    }
+    if (__ring_prep(self, req)) {
+        __ring_request_del(req);
+        return _PyErr_SetFromErrno();
+    }
+    Py_RETURN_NONE;
+}
+
+
+/* stop receiving from socket, what is already in flight still comes through */
+static int
+__ring_pause(Ring *self, Abstract *socket)
+{
+    RingRequest *req = NULL;
+
+    if (__ring_check(self)) {
+        return -1;
+    }
+    for (req = self->requests.next; req != &self->requests; req = req->next) {
+        if ((req->op == RING_RECV) && (req->socket == socket)) {
+            req->resume = 0;
+            if (__ring_cancel_request(self, req)) {
+                _PyErr_SetFromErrno();
+                return -1;
+            }
+        }
+    }
+    if (__ring_submit(self)) {
+        _PyErr_SetFromErrno();
+        return -1;
+    }
+    return 0;
+}
+
+
+/* receive from socket again, a recv whose cancellation is still pending is
+   rearmed as soon as it completes rather than doubled (that would split the
+   stream between the two) */
+static int
+__ring_resume(Ring *self, Abstract *socket, PyObject *buf, PyObject *callback)
+{
+    RingRequest *req = NULL;
+    PyObject *result = NULL;
+
+    if (__ring_check(self)) {
+        return -1;
+    }
+    for (req = self->requests.next; req != &self->requests; req = req->next) {
+        if ((req->op == RING_RECV) && (req->socket == socket)) {
+            req->resume = 1;
+            return 0;
+        }
+    }
+    if (!(result = __ring_queue(self, RING_RECV, socket, buf, callback))) {
+        return -1;
+    }
+    Py_DECREF(result);
+    if (__ring_submit(self)) {
+        _PyErr_SetFromErrno();
+        return -1;
+    }
+    return 0;
+}
+
+
+/* Ring_Type ---------------------------------------------------------------- */
+
+/* Ring_Type.tp_new */
+static PyObject *
+Ring_tp_new(PyTypeObject *type, PyObject *args, PyObject *kwargs)
+{
+    Ring *self = NULL;
+
+    if ((self = __ring_alloc(type)) && __ring_init(self, args, kwargs)) {
+        Py_CLEAR(self);
+    }
+    return (PyObject *)self;
+}
+
+
+/* Ring_Type.tp_traverse */
+static int
+Ring_tp_traverse(Ring *self, visitproc visit, void *arg)
+{
+    RingRequest *req = NULL;
+
+    for (req = self->requests.next; req != &self->requests; req = req->next) {
+        Py_VISIT(req->socket);
+        Py_VISIT(req->buf);
+        Py_VISIT(req->callback);
+    }
+    return 0;
+}
+
+
+/* Ring_Type.tp_clear */
+static int
+Ring_tp_clear(Ring *self)
+{
+    __ring_close(self);
+    PyErr_Clear();
+    return 0;
+}
+
+
+/* Ring_Type.tp_dealloc */
+static void
+Ring_tp_dealloc(Ring *self)
+{
+    if (PyObject_CallFinalizerFromDealloc((PyObject *)self)) {
+        return;
+    }
+    PyObject_GC_UnTrack(self);
+    Ring_tp_clear(self);
+    PyObject_GC_Del(self);
+}
+
+
+/* Ring_Type.tp_repr */
+static PyObject *
+Ring_tp_repr(Ring *self)
+{
+    return PyUnicode_FromFormat(
+        "<%s(fd=%d, entries=%u)>", Py_TYPE(self)->tp_name, self->fd, self->entries);
+}
+
+
+/* Ring.accept(socket, callback) */
+PyDoc_STRVAR(Ring_accept_doc,
+"accept(socket, callback)");
+
+static PyObject *
+Ring_accept(Ring *self, PyObject *args)
+{
+    Abstract *socket = NULL;
+    PyObject *callback = NULL;
+
+    if (!PyArg_ParseTuple(args, "O!O:accept", &Server_Type, &socket, &callback)) {
+        return NULL;
+    }
+    return __ring_queue(self, RING_ACCEPT, socket, NULL, callback);
+}
+
+
+/* Ring.recv(socket, buf, callback) */
+PyDoc_STRVAR(Ring_recv_doc,
+"recv(socket, buf, callback)");
+
+static PyObject *
+Ring_recv(Ring *self, PyObject *args)
+{
+    Abstract *socket = NULL;
+    PyObject *buf = NULL, *callback = NULL;
+
+    if (!PyArg_ParseTuple(args, "O!YO:recv", &Socket_Type, &socket, &buf,
+                          &callback)) {
+        return NULL;
+    }
+    return __ring_queue(self, RING_RECV, socket, buf, callback);
+}
+
+
+/* Ring.send(socket, buf, callback) */
+PyDoc_STRVAR(Ring_send_doc,
+"send(socket, buf, callback)");
+
+static PyObject *
+Ring_send(Ring *self, PyObject *args)
+{
+    Abstract *socket = NULL;
+    PyObject *buf = NULL, *callback = NULL;
+
+    if (!PyArg_ParseTuple(args, "O!YO:send", &Socket_Type, &socket, &buf,
+                          &callback)) {
+        return NULL;
+    }
+    return __ring_queue(self, RING_SEND, socket, buf, callback);
+}
+
+
+/* Ring.cancel(socket) */
+PyDoc_STRVAR(Ring_cancel_doc,
+"cancel(socket)");
+
+static PyObject *
+Ring_cancel(Ring *self, PyObject *args)
+{
+    Abstract *socket = NULL;
+
+    if (!PyArg_ParseTuple(args, "O!:cancel", &Abstract_Type, &socket)) {
+        return NULL;
+    }
+    if ((self->fd != -1) && (socket->fd != -1) && __ring_cancel(self, socket)) {
+        return _PyErr_SetFromErrno();
+    }
+    Py_RETURN_NONE;
+}
+
+
+/* Ring.submit() */
+PyDoc_STRVAR(Ring_submit_doc,
+"submit()");
+
+static PyObject *
+Ring_submit(Ring *self)
+{
+    if (__ring_check(self)) {
+        return NULL;
+    }
+    if (__ring_submit(self)) {
+        return _PyErr_SetFromErrno();
+    }
+    Py_RETURN_NONE;
+}
+
+
+/* Ring.reap() */
+PyDoc_STRVAR(Ring_reap_doc,
+"reap() -> [(callback, result), ...]");
+
+static PyObject *
+Ring_reap(Ring *self)
+{
+    return (__ring_check(self)) ? NULL : __ring_reap(self);
+}
+
+
+/* Ring.close() */
+PyDoc_STRVAR(Ring_close_doc,
+"close()");
+
+static PyObject *
+Ring_close(Ring *self)
+{
+    return (__ring_close(self)) ? NULL : __Py_INCREF(Py_None);
+}
+
+
+/* Ring.fileno() */
+PyDoc_STRVAR(Ring_fileno_doc,
+"fileno() -> int");
+
+static PyObject *
+Ring_fileno(Ring *self)
+{
+    return PyLong_FromLong(self->efd);
+}
+
+
+/* Ring_Type.tp_methods */
+static PyMethodDef Ring_tp_methods[] = {
+    {"accept", (PyCFunction)Ring_accept, METH_VARARGS, Ring_accept_doc},
+    {"recv", (PyCFunction)Ring_recv, METH_VARARGS, Ring_recv_doc},
+    {"send", (PyCFunction)Ring_send, METH_VARARGS, Ring_send_doc},
+    {"cancel", (PyCFunction)Ring_cancel, METH_VARARGS, Ring_cancel_doc},
+    {"submit", (PyCFunction)Ring_submit, METH_NOARGS, Ring_submit_doc},
+    {"reap", (PyCFunction)Ring_reap, METH_NOARGS, Ring_reap_doc},
+    {"close", (PyCFunction)Ring_close, METH_NOARGS, Ring_close_doc},
+    {"fileno", (PyCFunction)Ring_fileno, METH_NOARGS, Ring_fileno_doc},
+    {NULL}  /* Sentinel */
+};
+
+
+/* Ring.closed */
+static PyObject *
+Ring_closed_get(Ring *self, void *closure)
+{
+    return PyBool_FromLong((self->fd == -1));
+}
+
+
+/* Ring_Type.tp_getset */
+static PyGetSetDef Ring_tp_getset[] = {
+    {"closed", (getter)Ring_closed_get, _Py_READONLY_ATTRIBUTE, NULL, NULL},
+    {NULL}  /* Sentinel */
+};
+
+
+/* Ring_Type.tp_finalize */
+static void
+Ring_tp_finalize(Ring *self)
+{
+    PyObject *exc_type, *exc_value, *exc_traceback;
+
+    PyErr_Fetch(&exc_type, &exc_value, &exc_traceback);
+    if (__ring_close(self)) {
+        PyErr_WriteUnraisable((PyObject *)self);
+    }
+    PyErr_Restore(exc_type, exc_value, exc_traceback);
+}
+
+
+static PyTypeObject Ring_Type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "mood.ippc.sockets.Ring",
+    .tp_basicsize = sizeof(Ring),
+    .tp_dealloc = (destructor)Ring_tp_dealloc,
+    .tp_repr = (reprfunc)Ring_tp_repr,
+    .tp_flags = (Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC | Py_TPFLAGS_HAVE_FINALIZE),
+    .tp_traverse = (traverseproc)Ring_tp_traverse,
+    .tp_clear = (inquiry)Ring_tp_clear,
+    .tp_methods = Ring_tp_methods,
+    .tp_getset = Ring_tp_getset,
+    .tp_finalize = (destructor)Ring_tp_finalize,
+    .tp_new = Ring_tp_new,
+};
+
+#endif /* HAVE_IO_URING */
+
+
+/* --------------------------------------------------------------------------
+   Connection
+   -------------------------------------------------------------------------- */
+
+/* logging levels, see Connection.__on_error__() */
+#define CONN_DEBUG 10
+#define CONN_ERROR 40
+
+/* small frames queued together are written at once, up to that size */
+#define CONN_COALESCE 65536
+
+
+/* a queued read (buf is NULL, size is -1 for a whole frame) or write (size is
+   what a ring send in flight will consume) */
+typedef struct {
+    PyObject *buf;
+    PyObject *callback;
+    PyObject *args;
+    Py_ssize_t size;
+} ConnTask;
+
+
+/* a double-ended queue of tasks, alloc is a power of 2 */
+typedef struct {
+    ConnTask *tasks;
+    Py_ssize_t alloc;
+    Py_ssize_t head;
+    Py_ssize_t len;
+} ConnQueue;
+
+
+/* Connection */
+typedef struct {
+    PyObject_HEAD
+    Abstract *socket;
+    PyObject *transport; // the socket or a channel
+    PyByteArrayObject *rbuf;
+    PyObject *reader;
+    PyObject *writer;
+    PyObject *logger;
+    PyObject *on_close;
+    PyObject *on_pressure;
+#ifdef HAVE_IO_URING
+    Ring *ring;
+#endif
+    ConnQueue rtasks;
+    ConnQueue wtasks;
+    Py_ssize_t wsize;
+    Py_ssize_t high;
+    Py_ssize_t low;
+    Py_ssize_t coalesce;
+    int64_t rtime; // last read
+    int64_t stamp; // arrival of what is left in rbuf, 0 if empty
+    char writing; // writer started, or ring send in flight
+    char draining;
+    char paused;
+    char closing;
+} Connection;
+
+
+#define __conn_closed(s) (!(s)->socket || ((s)->socket->fd == -1))
+
+#define __conn_isset(o) ((o) && ((o) != Py_None))
+
+
+static inline void
+__buf_consume(PyByteArrayObject *buf, Py_ssize_t size)
+{
+    // XXX: very bad shortcut ¯\_(ツ)_/¯
+    buf->ob_start += size;
+    __buf_terminate(buf, (Py_SIZE(buf) - size));
+}
+
+
+/* queue -------------------------------------------------------------------- */
+
+#define __queue_at(q, i) ((q)->tasks + (((q)->head + (i)) & ((q)->alloc - 1)))
+
+
+static inline int
+__queue_reserve(ConnQueue *self)
+{
+    ConnTask *tasks = NULL;
+    Py_ssize_t alloc = 0, i;
+
+    if (self->len < self->alloc) {
+        return 0;
+    }
+    alloc = (self->alloc) ? (self->alloc << 1) : 8;
+    if (!(tasks = PyMem_Malloc(alloc * sizeof(ConnTask)))) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    for (i = 0; i < self->len; i++) {
+        tasks[i] = *__queue_at(self, i);
+    }
+    PyMem_Free(self->tasks);
+    self->tasks = tasks;
+    self->alloc = alloc;
+    self->head = 0;
+    return 0;
+}
+
+
+/* the queue takes over the references held by task */
+static inline int
+__queue_append(ConnQueue *self, ConnTask *task)
+{
+    if (__queue_reserve(self)) {
+        return -1;
+    }
+    *__queue_at(self, self->len++) = *task;
+    return 0;
+}
+
+
+static inline int
+__queue_appendleft(ConnQueue *self, ConnTask *task)
+{
+    if (__queue_reserve(self)) {
+        return -1;
+    }
+    self->head = (self->head - 1) & (self->alloc - 1);
+    self->len++;
+    *__queue_at(self, 0) = *task;
+    return 0;
+}
+
+
+/* the caller takes over the references held by task */
+static inline void
+__queue_popleft(ConnQueue *self, ConnTask *task)
+{
+    *task = *__queue_at(self, 0);
+    self->head = (self->head + 1) & (self->alloc - 1);
+    self->len--;
+}
+
+
+static inline void
+__task_clear(ConnTask *task)
+{
+    Py_CLEAR(task->buf);
+    Py_CLEAR(task->callback);
+    Py_CLEAR(task->args);
+}
+
+
+static inline void
+__queue_clear(ConnQueue *self)
+{
+    ConnTask task;
+
+    // one at a time, releasing a task may run arbitrary code
+    while (self->len) {
+        __queue_popleft(self, &task);
+        __task_clear(&task);
+    }
+}
+
+
+static inline int
+__queue_traverse(ConnQueue *self, visitproc visit, void *arg)
+{
+    ConnTask *task = NULL;
+    Py_ssize_t i;
+
+    for (i = 0; i < self->len; i++) {
+        task = __queue_at(self, i);
+        Py_VISIT(task->buf);
+        Py_VISIT(task->callback);
+        Py_VISIT(task->args);
+    }
+    return 0;
+}
+
+
+/* errors ------------------------------------------------------------------- */
+
+/* self.__on_error__(message, level, exc_info), which closes the connection */
+static void
+__connection_error(Connection *self, int level, PyObject *exc_info,
+                   const char *format, ...)
+{
+    PyObject *message = NULL, *result = NULL;
+    va_list vargs;
+
+    va_start(vargs, format);
+    message = PyUnicode_FromFormatV(format, vargs);
+    va_end(vargs);
+    if (message) {
+        result = PyObject_CallMethod((PyObject *)self, "__on_error__", "OiO",
+                                     message, level, exc_info);
+        Py_DECREF(message);
+    }
+    if (!result) {
+        PyErr_WriteUnraisable((PyObject *)self);
+    }
+    Py_XDECREF(result);
+}
+
+
+/* report the pending exception */
+static void
+__connection_fail(Connection *self, const char *message)
+{
+    PyObject *exc = __exception();
+
+    __connection_error(self, CONN_ERROR, (exc) ? exc : Py_True, "%s", message);
+    Py_XDECREF(exc);
+}
+
+
+static inline int
+__connection_check(Connection *self)
+{
+    if (__conn_closed(self)) {
+        PyErr_Format(PyExc_ConnectionError, "%S: already closed.", self);
+        return -1;
+    }
+    return 0;
+}
+
+
+static inline int
+__connection_debug(Connection *self, const char *message)
+{
+    PyObject *result = NULL;
+
+    if (__conn_isset(self->logger)) {
+        if (!(result = PyObject_CallMethod(self->logger, "debug", "N",
+                                           PyUnicode_FromFormat("%S: %s", self,
+                                                                message)))) {
+            return -1;
+        }
+        Py_DECREF(result);
+    }
+    return 0;
+}
+
+
+/* callback(arg, *args), an Exception is reported and closes the connection,
+   anything else (KeyboardInterrupt, SystemExit) goes up to the caller */
+static int
+__connection_run(Connection *self, PyObject *callback, PyObject *arg,
+                 PyObject *args)
+{
+    PyObject *result = NULL, *_args_ = NULL, *exc = NULL, *name = NULL;
+    Py_ssize_t i, n = (args) ? PyTuple_GET_SIZE(args) : 0;
+
+    if (!n) {
+        result = PyObject_Vectorcall(callback, &arg, (arg) ? 1 : 0, NULL);
+    }
+    else if (!arg) {
+        result = PyObject_Call(callback, args, NULL);
+    }
+    else if ((_args_ = PyTuple_New(n + 1))) {
+        PyTuple_SET_ITEM(_args_, 0, __Py_INCREF(arg));
+        for (i = 0; i < n; i++) {
+            PyTuple_SET_ITEM(_args_, (i + 1),
+                             __Py_INCREF(PyTuple_GET_ITEM(args, i)));
+        }
+        result = PyObject_Call(callback, _args_, NULL);
+        Py_DECREF(_args_);
+    }
+    if (result) {
+        Py_DECREF(result);
+        return 0;
+    }
+    if (!PyErr_ExceptionMatches(PyExc_Exception)) {
+        return -1;
+    }
+    exc = __exception();
+    if (!(name = PyObject_GetAttrString(callback, "__qualname__"))) {
+        PyErr_Clear();
+        name = __Py_INCREF(callback);
+    }
+    __connection_error(self, CONN_ERROR, exc, "error in %S callback", name);
+    Py_DECREF(name);
+    Py_XDECREF(exc);
+    return 0;
+}
+
+
+static inline int
+__watcher_call(PyObject *watcher, const char *name)
+{
+    PyObject *result = NULL;
+
+    if (__conn_isset(watcher)) {
+        if (!(result = PyObject_CallMethod(watcher, name, NULL))) {
+            return -1;
+        }
+        Py_DECREF(result);
+    }
+    return 0;
+}
+
+
+/* from here on, -1 means an exception goes up to the caller; i/o errors and
+   errors in callbacks are reported through __on_error__() */
+
+
+/* read --------------------------------------------------------------------- */
+
+/* a frame handed over in a sealed memfd (see Socket.write()), its payload is
+   a view of the mapping */
+static PyObject *
+__frame_mapped(Abstract *socket)
+{
+    PyObject *mmap = NULL, *map = NULL, *view = NULL, *result = NULL;
+    Py_buffer *data = NULL;
+    Py_ssize_t hlen = 0;
+    int fd = -1, seals = 0;
+
+    if ((fd = __fds_pop(socket)) == -1) {
+        return NULL;
+    }
+    if ((seals = fcntl(fd, F_GET_SEALS)) == -1) {
+        _PyErr_SetFromErrno();
+    }
+    else if ((seals & (F_SEAL_SHRINK | F_SEAL_WRITE)) !=
+             (F_SEAL_SHRINK | F_SEAL_WRITE)) {
+        PyErr_SetString(PyExc_ValueError, "Invalid memfd frame");
+    }
+    else if ((mmap = PyImport_ImportModule("mmap"))) {
+        map = PyObject_CallMethod(mmap, "mmap", "iiii",
+                                  fd, 0, MAP_SHARED, PROT_READ);
+        Py_DECREF(mmap);
+    }
+    close(fd); // the mapping holds its own reference
+    if (map && (view = PyMemoryView_FromObject(map))) {
+        data = PyMemoryView_GET_BUFFER(view);
+        hlen = (data->len) ? 1 + (uint8_t)((char *)data->buf)[0] : 0;
+        if (!hlen || (hlen > data->len)) {
+            PyErr_SetString(PyExc_ValueError, "Invalid memfd frame");
+        }
+        else {
+            result = PySequence_GetSlice(view, hlen, data->len);
+        }
+    }
+    Py_XDECREF(view);
+    Py_XDECREF(map);
+    return result;
+}
+
+
+/* the payload of the frame at the start of rbuf in *buf, 0 until complete */
+static int
+__connection_frame(Connection *self, PyObject **buf)
+{
+    PyByteArrayObject *rbuf = self->rbuf;
+    PyObject *result = NULL;
+    Py_ssize_t hlen = 0, size = 0;
+    int res = 0;
+
+    // a null byte is never a valid frame header, it announces a channel (see
+    // __handshake__())
+    while (Py_SIZE(rbuf) && !rbuf->ob_start[0]) {
+        __buf_consume(rbuf, 1);
+        if (!(result = PyObject_CallMethod((PyObject *)self, "__handshake__",
+                                           NULL))) {
+            return -1;
+        }
+        Py_DECREF(result);
+    }
+    if ((res = __frame_size(rbuf, &hlen, &size)) == 1) {
+        if ((uint8_t)rbuf->ob_start[0] == SOCK_MEMFD_FRAME) {
+            __buf_consume(rbuf, 1);
+            *buf = __frame_mapped(self->socket);
+        }
+        else if ((*buf = PyByteArray_FromStringAndSize((rbuf->ob_start + hlen),
+                                                       size))) {
+            __buf_consume(rbuf, (hlen + size));
+        }
+        res = (*buf) ? 1 : -1;
+    }
+    return res;
+}
+
+
+/* 1 if task was consumed, 0 if it waits for more data */
+static int
+__connection_consume(Connection *self, ConnTask *task)
+{
+    PyByteArrayObject *rbuf = self->rbuf;
+    PyObject *buf = NULL;
+    int res = 0;
+
+    if (task->size == -1) {
+        if ((res = __connection_frame(self, &buf)) == -1) {
+            __connection_fail(self, "error while reading a frame");
+            return 1;
+        }
+    }
+    else if ((res = (Py_SIZE(rbuf) >= task->size))) {
+        buf = PyByteArray_FromStringAndSize(rbuf->ob_start, task->size);
+        if (!buf) {
+            __connection_fail(self, "error while reading data");
+            return 1;
+        }
+        __buf_consume(rbuf, task->size);
+    }
+    if (res) {
+        res = (__connection_run(self, task->callback, buf, task->args)) ? -1 : 1;
+        Py_DECREF(buf);
+    }
+    return res;
+}
+
+
+static int __connection_push(Connection *self);
+
+/* reads issued from callbacks are queued and consumed here, in a loop, so
+   that pipelined frames do not recurse */
+static int
+__connection_drain(Connection *self)
+{
+    ConnTask task;
+    int res = 0;
+
+    self->draining = 1;
+    while (self->rtasks.len && !self->paused && !__conn_closed(self)) {
+        __queue_popleft(&self->rtasks, &task);
+        if (!(res = __connection_consume(self, &task))) {
+            // what is left is the start of a frame, it came with the last read
+            // at the earliest
+            self->stamp = self->rtime;
+            if (__queue_appendleft(&self->rtasks, &task)) {
+                __task_clear(&task);
+                __connection_fail(self, "error while reading data");
+            }
+            break;
+        }
+        __task_clear(&task);
+        if (res == -1) {
+            break;
+        }
+    }
+    if (!Py_SIZE(self->rbuf)) {
+        self->stamp = 0;
+    }
+    self->draining = 0;
+    if (res == -1) {
+        return -1;
+    }
+    // the replies to frames read together go out together
+    return (self->wtasks.len) ? __connection_push(self) : 0;
+}
+
+
+static int
+__connection_data(Connection *self, int closed)
+{
+    self->rtime = __clock_ns();
+    if (!self->stamp) {
+        self->stamp = self->rtime;
+    }
+    if (__connection_drain(self)) {
+        return -1;
+    }
+    if (closed) {
+        // remote end closed the connection
+        __connection_error(self, CONN_DEBUG, Py_False, "closed by peer");
+    }
+    return 0;
+}
+
+
+static int
+__connection_recv(Connection *self)
+{
+    int res = -1;
+
+    res = ((Abstract *)self->transport == self->socket) ?
+        __socket_recv(self->socket, self->rbuf) :
+        __channel_recv((Channel *)self->transport, self->rbuf);
+    if (res == -1) {
+        if (PyErr_ExceptionMatches(PyExc_BlockingIOError)) {
+            PyErr_Clear();
+        }
+        else {
+            __connection_fail(self, "error while reading data");
+        }
+        return 0;
+    }
+    return __connection_data(self, res);
+}
+
+
+static PyObject *
+__connection_read(Connection *self, Py_ssize_t size, PyObject *args,
+                  Py_ssize_t i)
+{
+    Py_ssize_t n = PyTuple_GET_SIZE(args);
+    ConnTask task = { NULL, NULL, NULL, size };
+
+    if (__connection_check(self)) {
+        return NULL;
+    }
+    task.callback = __Py_INCREF(PyTuple_GET_ITEM(args, i));
+    if (
+        ((n > (i + 1)) && !(task.args = PyTuple_GetSlice(args, (i + 1), n))) ||
+        __queue_append(&self->rtasks, &task)
+       ) {
+        __task_clear(&task);
+        return NULL;
+    }
+    if (!self->draining && __connection_drain(self)) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+
+/* backpressure ------------------------------------------------------------- */
+
+static inline int
+__connection_reading(Connection *self, int enabled)
+{
+#ifdef HAVE_IO_URING
+    PyObject *callback = NULL;
+    int res = -1;
+
+    // only the multishot recv is cancelled, sends keep going
+    if (self->ring) {
+        if (!enabled) {
+            return __ring_pause(self->ring, self->socket);
+        }
+        callback = PyObject_GetAttrString((PyObject *)self, "__on_recv__");
+        if (callback) {
+            res = __ring_resume(self->ring, self->socket,
+                                (PyObject *)self->rbuf, callback);
+            Py_DECREF(callback);
+        }
+        return res;
+    }
+#endif
+    return __watcher_call(self->reader, (enabled) ? "start" : "stop");
+}
+
+
+static int
+__connection_pressure(Connection *self, PyObject *paused)
+{
+    PyObject *callback = NULL, *args = NULL;
+    int res = -1;
+
+    if (!__conn_isset(self->on_pressure)) {
+        return 0;
+    }
+    callback = __Py_INCREF(self->on_pressure);
+    if ((args = PyTuple_Pack(1, paused))) {
+        res = __connection_run(self, callback, (PyObject *)self, args);
+        Py_DECREF(args);
+    }
+    Py_DECREF(callback);
+    return res;
+}
+
+
+/* too much queued for the peer, stop taking more work from it */
+static int
+__connection_pause(Connection *self)
+{
+    self->paused = 1;
+    if (__connection_reading(self, 0)) {
+        return -1;
+    }
+    return __connection_pressure(self, Py_True);
+}
+
+
+static int
+__connection_resume(Connection *self)
+{
+    self->paused = 0;
+    if (!__conn_closed(self)) {
+        if (
+            __connection_reading(self, 1) ||
+            __connection_pressure(self, Py_False)
+           ) {
+            return -1;
+        }
+        if (!(__conn_closed(self) || self->draining)) {
+            return __connection_drain(self);
+        }
+    }
+    return 0;
+}
+
+
+/* write -------------------------------------------------------------------- */
+
+/* merge the small frames at the head of the queue into the first one, a frame
+   with a callback ends the merge */
+static int
+__connection_coalesce(Connection *self)
+{
+    ConnQueue *wtasks = &self->wtasks;
+    ConnTask *head = __queue_at(wtasks, 0), *next = NULL;
+    PyByteArrayObject *buf = (PyByteArrayObject *)head->buf, *data = NULL;
+    Py_ssize_t len = Py_SIZE(buf);
+
+    while (
+        (wtasks->len > 1) && !head->callback && !buf->ob_exports &&
+        ((len + Py_SIZE((next = __queue_at(wtasks, 1))->buf)) <= self->coalesce)
+       ) {
+        data = (PyByteArrayObject *)next->buf;
+        if (__buf_resize(buf, (len + Py_SIZE(data)))) {
+            return -1;
+        }
+        memcpy((buf->ob_start + len), data->ob_start, Py_SIZE(data));
+        len = __buf_terminate(buf, (len + Py_SIZE(data)));
+        // the merged frame ends here now, its callback with it
+        Py_DECREF(data);
+        Py_XDECREF(head->args);
+        next->buf = head->buf;
+        wtasks->head = (wtasks->head + 1) & (wtasks->alloc - 1);
+        wtasks->len--;
+        head = next;
+    }
+    return 0;
+}
+
+
+static int
+__connection_write(Connection *self)
+{
+    PyByteArrayObject *buf = NULL;
+    ConnTask task;
+    Py_ssize_t size = 0;
+    int res = 0;
+
+    while (self->wtasks.len) {
+        if ((self->wtasks.len > 1) && __connection_coalesce(self)) {
+            __connection_fail(self, "error while writing data");
+            break;
+        }
+        __queue_popleft(&self->wtasks, &task);
+        buf = (PyByteArrayObject *)task.buf;
+        size = Py_SIZE(buf);
+        res = ((Abstract *)self->transport == self->socket) ?
+            __socket_send(self->socket, buf) :
+            __channel_send((Channel *)self->transport, buf);
+        // BlockingIOError may come after part of buf went out
+        self->wsize -= size - Py_SIZE(buf);
+        if ((res == -1) && !PyErr_ExceptionMatches(PyExc_BlockingIOError)) {
+            __task_clear(&task);
+            __connection_fail(self, "error while writing data");
+            res = 0;
+            break;
+        }
+        if ((res == -1) || Py_SIZE(buf)) {
+            PyErr_Clear();
+            if ((res = __queue_appendleft(&self->wtasks, &task))) {
+                __task_clear(&task);
+                __connection_fail(self, "error while writing data");
+                res = 0;
+            }
+            break;
+        }
+        if (!self->wtasks.len && self->writing) {
+            if (__watcher_call(self->writer, "stop")) {
+                __task_clear(&task);
+                __connection_fail(self, "error while writing data");
+                break;
+            }
+            self->writing = 0;
+        }
+        if (task.callback) {
+            res = __connection_run(self, task.callback, NULL, task.args);
+        }
+        __task_clear(&task);
+        if (res) {
+            return -1;
+        }
+    }
+    if (self->paused && (self->wsize <= self->low)) {
+        return __connection_resume(self);
+    }
+    return 0;
+}
+
+
+#ifdef HAVE_IO_URING
+
+/* one send in flight at a time, the next one goes out from __on_send__() */
+static int
+__connection_send(Connection *self)
+{
+    PyObject *callback = NULL, *result = NULL;
+    ConnTask *task = NULL;
+
+    if (!self->writing && self->wtasks.len) {
+        if ((self->wtasks.len > 1) && __connection_coalesce(self)) {
+            __connection_fail(self, "error while writing data");
+            return 0;
+        }
+        task = __queue_at(&self->wtasks, 0);
+        task->size = Py_SIZE(task->buf); // consumed by the ring
+        callback = PyObject_GetAttrString((PyObject *)self, "__on_send__");
+        if (callback) {
+            result = __ring_queue(self->ring, RING_SEND, self->socket,
+                                  task->buf, callback);
+            Py_DECREF(callback);
+        }
+        if (!result) {
+            __connection_fail(self, "error while writing data");
+            return 0;
+        }
+        Py_DECREF(result);
+        self->writing = 1;
+    }
+    return 0;
+}
+
+#endif /* HAVE_IO_URING */
+
+
+/* write right away, only wait for the transport with what is left (a channel
+   is always writable, its doorbell only rings once the peer made room) */
+static int
+__connection_push(Connection *self)
+{
+#ifdef HAVE_IO_URING
+    if (self->ring) {
+        return __connection_send(self);
+    }
+#endif
+    if (!self->writing) {
+        if (__connection_write(self)) {
+            return -1;
+        }
+        if (self->wtasks.len && !__conn_closed(self)) {
+            if (__watcher_call(self->writer, "start")) {
+                __connection_fail(self, "error while writing data");
+            }
+            else {
+                self->writing = 1;
+            }
+        }
+    }
+    return 0;
+}
+
+
+/* close -------------------------------------------------------------------- */
+
+static inline int
+__connection_unwatch(Connection *self)
+{
+#ifdef HAVE_IO_URING
+    if (self->ring) {
+        if (
+            (self->ring->fd != -1) && !__conn_closed(self) &&
+            __ring_cancel(self->ring, self->socket)
+           ) {
+            _PyErr_SetFromErrno();
+            return -1;
+        }
+        return 0;
+    }
+#endif
+    if (
+        __watcher_call(self->reader, "stop") ||
+        __watcher_call(self->writer, "stop")
+       ) {
+        return -1;
+    }
+    return 0;
+}
+
+
+static int
+__connection_stop(Connection *self)
+{
+    if (__connection_unwatch(self)) {
+        return -1;
+    }
+    self->writing = 0;
+    __queue_clear(&self->rtasks);
+    if (PyByteArray_Resize((PyObject *)self->rbuf, 0)) {
+        return -1;
+    }
+    __queue_clear(&self->wtasks);
+    self->wsize = 0;
+    return (self->socket) ? __socket_close(self->socket) : 0;
+}
+
+
+/* keep the first exception, report the others */
+static inline void
+__connection_keep(Connection *self, PyObject **exc)
+{
+    if (!*exc) {
+        *exc = __exception();
+    }
+    else {
+        PyErr_WriteUnraisable((PyObject *)self);
+    }
+}
+
+
+static PyObject *
+__connection_close(Connection *self, int notify)
+{
+    PyObject *result = NULL, *exc = NULL, *callback = NULL;
+
+    if (__conn_closed(self) || self->closing) {
+        Py_RETURN_NONE;
+    }
+    self->closing = 1;
+    if (
+        __connection_debug(self, "closing...") ||
+        !(result = PyObject_CallMethod((PyObject *)self, "__stop__", NULL))
+       ) {
+        __connection_keep(self, &exc);
+    }
+    Py_CLEAR(result);
+    if (!(result = PyObject_CallMethod((PyObject *)self, "__cleanup__", NULL))) {
+        __connection_keep(self, &exc);
+    }
+    Py_CLEAR(result);
+    if (__conn_isset(self->on_close)) {
+        callback = self->on_close;
+        self->on_close = NULL;
+        if (notify && __connection_run(self, callback, (PyObject *)self, NULL)) {
+            __connection_keep(self, &exc);
+        }
+        Py_DECREF(callback);
+    }
+    if (__connection_debug(self, "closed")) {
+        __connection_keep(self, &exc);
+    }
+    self->closing = 0;
+    if (exc) {
+        PyErr_Restore(__Py_INCREF((PyObject *)Py_TYPE(exc)), exc,
+                      PyException_GetTraceback(exc));
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+static inline Connection *
+__connection_alloc(PyTypeObject *type)
+{
+    Connection *self = NULL;
+
+    if ((self = (Connection *)type->tp_alloc(type, 0))) {
+        self->coalesce = CONN_COALESCE;
+        self->rbuf = (PyByteArrayObject *)PyByteArray_FromStringAndSize(NULL, 0);
+        if (!self->rbuf) {
+            Py_CLEAR(self);
+        }
+    }
+    return self;
+}
+
+
+/* Connection_Type ---------------------------------------------------------- */
+
+/* Connection_Type.tp_new */
+static PyObject *
+Connection_tp_new(PyTypeObject *type, PyObject *args, PyObject *kwargs)
+{
+    // the socket and watchers are set up by subclasses, see __setup__()
+    return (PyObject *)__connection_alloc(type);
+}
+
+
+/* Connection_Type.tp_traverse */
+static int
+Connection_tp_traverse(Connection *self, visitproc visit, void *arg)
+{
+    Py_VISIT(self->socket);
+    Py_VISIT(self->transport);
+    Py_VISIT(self->rbuf);
+    Py_VISIT(self->reader);
+    Py_VISIT(self->writer);
+    Py_VISIT(self->logger);
+    Py_VISIT(self->on_close);
+    Py_VISIT(self->on_pressure);
+#ifdef HAVE_IO_URING
+    Py_VISIT(self->ring);
+#endif
+    return (
+        __queue_traverse(&self->rtasks, visit, arg) ||
+        __queue_traverse(&self->wtasks, visit, arg)
+    );
+}
+
+
+/* Connection_Type.tp_clear */
+static int
+Connection_tp_clear(Connection *self)
+{
+    __queue_clear(&self->rtasks);
+    __queue_clear(&self->wtasks);
+#ifdef HAVE_IO_URING
+    Py_CLEAR(self->ring);
+#endif
+    Py_CLEAR(self->on_pressure);
+    Py_CLEAR(self->on_close);
+    Py_CLEAR(self->logger);
+    Py_CLEAR(self->writer);
+    Py_CLEAR(self->reader);
+    Py_CLEAR(self->rbuf);
+    Py_CLEAR(self->transport);
+    Py_CLEAR(self->socket);
+    return 0;
+}
+
+
+/* Connection_Type.tp_dealloc */
+static void
+Connection_tp_dealloc(Connection *self)
+{
+    PyObject_GC_UnTrack(self);
+    Connection_tp_clear(self);
+    PyMem_Free(self->rtasks.tasks);
+    PyMem_Free(self->wtasks.tasks);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+
+/* Connection.close([notify=True]) */
+PyDoc_STRVAR(Connection_close_doc,
+"close([notify=True])");
+
+static PyObject *
+Connection_close(Connection *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"notify", NULL};
+    int notify = 1;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|p:close", kwlist,
+                                     &notify)) {
+        return NULL;
+    }
+    return __connection_close(self, notify);
+}
+
+
+/* Connection.read(size, cb, *args) */
+PyDoc_STRVAR(Connection_read_doc,
+"read(size, cb, *args)");
+
+static PyObject *
+Connection_read(Connection *self, PyObject *args)
+{
+    Py_ssize_t size = 0;
+
+    if (PyTuple_GET_SIZE(args) < 2) {
+        PyErr_SetString(PyExc_TypeError, "read() takes at least 2 arguments");
+        return NULL;
+    }
+    if (
+        ((size = PyLong_AsSsize_t(PyTuple_GET_ITEM(args, 0))) == -1) &&
+        PyErr_Occurred()
+       ) {
+        return NULL;
+    }
+    if (size < 0) {
+        PyErr_SetString(PyExc_ValueError, "size must be positive");
+        return NULL;
+    }
+    if (!size) {
+        Py_RETURN_NONE;
+    }
+    return __connection_read(self, size, args, 1);
+}
+
+
+/* Connection.receive(cb, *args) */
+PyDoc_STRVAR(Connection_receive_doc,
+"receive(cb, *args)");
+
+// cb(msg, *args) with the payload of the next frame
+static PyObject *
+Connection_receive(Connection *self, PyObject *args)
+{
+    if (PyTuple_GET_SIZE(args) < 1) {
+        PyErr_SetString(PyExc_TypeError, "receive() takes at least 1 argument");
+        return NULL;
+    }
+    return __connection_read(self, -1, args, 0);
+}
+
+
+/* Connection.write(buf[, cb=None, args=()]) */
+PyDoc_STRVAR(Connection_write_doc,
+"write(buf[, cb=None, args=()])");
+
+static PyObject *
+Connection_write(Connection *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"buf", "cb", "args", NULL};
+    PyObject *buf = NULL, *callback = Py_None, *_args_ = NULL;
+    ConnTask task = { NULL, NULL, NULL, 0 };
+
+    if (!kwargs && (PyTuple_GET_SIZE(args) == 1)) {
+        buf = PyTuple_GET_ITEM(args, 0);
+    }
+    else if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|OO!:write", kwlist,
+                                          &buf, &callback,
+                                          &PyTuple_Type, &_args_)) {
+        return NULL;
+    }
+    if (buf == Py_None) {
+        Py_RETURN_NONE;
+    }
+    if (!PyByteArray_Check(buf)) {
+        PyErr_Format(PyExc_TypeError, "expected bytearray or None, got %.200s",
+                     Py_TYPE(buf)->tp_name);
+        return NULL;
+    }
+    if (!Py_SIZE(buf)) {
+        Py_RETURN_NONE;
+    }
+    if (__connection_check(self)) {
+        return NULL;
+    }
+    task.buf = __Py_INCREF(buf);
+    if (callback != Py_None) {
+        task.callback = __Py_INCREF(callback);
+        if (_args_ && PyTuple_GET_SIZE(_args_)) {
+            task.args = __Py_INCREF(_args_);
+        }
+    }
+    if (__queue_append(&self->wtasks, &task)) {
+        __task_clear(&task);
+        return NULL;
+    }
+    self->wsize += Py_SIZE(buf);
+    if (
+        (self->high && (self->wsize > self->high) && !self->paused &&
+         __connection_pause(self)) ||
+        // while draining, wait for the other replies (see __connection_drain)
+        (!(self->draining || self->writing) && __connection_push(self))
+       ) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+
+/* Connection.watermarks(high[, low=None, on_pressure=None]) */
+PyDoc_STRVAR(Connection_watermarks_doc,
+"watermarks(high[, low=None, on_pressure=None])");
+
+// in queued bytes, reading stops above high and resumes at low (high / 4 by
+// default), high is 0 to disable; on_pressure(connection, paused) is called
+// on each transition
+static PyObject *
+Connection_watermarks(Connection *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"high", "low", "on_pressure", NULL};
+    PyObject *low = Py_None, *on_pressure = Py_None;
+    Py_ssize_t high = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "n|OO:watermarks", kwlist,
+                                     &high, &low, &on_pressure)) {
+        return NULL;
+    }
+    if (low == Py_None) {
+        self->low = high >> 2;
+    }
+    else if (((self->low = PyLong_AsSsize_t(low)) == -1) && PyErr_Occurred()) {
+        return NULL;
+    }
+    self->high = high;
+    _Py_SET_MEMBER(self->on_pressure, on_pressure);
+    Py_RETURN_NONE;
+}
+
+
+/* Connection.__on_read__(*args) */
+PyDoc_STRVAR(Connection___on_read___doc,
+"__on_read__(*args)");
+
+// watcher callback
+static PyObject *
+Connection___on_read__(Connection *self, PyObject *args)
+{
+    return (__connection_recv(self)) ? NULL : __Py_INCREF(Py_None);
+}
+
+
+/* Connection.__on_write__(*args) */
+PyDoc_STRVAR(Connection___on_write___doc,
+"__on_write__(*args)");
+
+// watcher callback
+static PyObject *
+Connection___on_write__(Connection *self, PyObject *args)
+{
+    return (__connection_write(self)) ? NULL : __Py_INCREF(Py_None);
+}
+
+
+/* Connection.__push__() */
+PyDoc_STRVAR(Connection___push___doc,
+"__push__()");
+
+static PyObject *
+Connection___push__(Connection *self)
+{
+    return (__connection_push(self)) ? NULL : __Py_INCREF(Py_None);
+}
+
+
+/* Connection.__handshake__() */
+PyDoc_STRVAR(Connection___handshake___doc,
+"__handshake__()");
+
+// the peer announced a channel (a null byte in place of a frame header),
+// subclasses that accept channels take it from there
+static PyObject *
+Connection___handshake__(Connection *self)
+{
+    PyErr_SetString(PyExc_ValueError, "Invalid frame");
+    return NULL;
+}
+
+
+/* Connection.__stop__() */
+PyDoc_STRVAR(Connection___stop___doc,
+"__stop__()");
+
+static PyObject *
+Connection___stop__(Connection *self)
+{
+    return (__connection_stop(self)) ? NULL : __Py_INCREF(Py_None);
+}
+
+
+/* Connection.__cleanup__() */
+PyDoc_STRVAR(Connection___cleanup___doc,
+"__cleanup__()");
+
+static PyObject *
+Connection___cleanup__(Connection *self)
+{
+    // break cycles
+    Py_CLEAR(self->reader);
+    Py_CLEAR(self->writer);
+#ifdef HAVE_IO_URING
+    Py_CLEAR(self->ring);
+#endif
+    Py_RETURN_NONE;
+}
+
+
+#ifdef HAVE_IO_URING
+
+/* Connection.__on_recv__(result) */
+PyDoc_STRVAR(Connection___on_recv___doc,
+"__on_recv__(result)");
+
+// ring callback
+static PyObject *
+Connection___on_recv__(Connection *self, PyObject *args)
+{
+    PyObject *result = NULL;
+    int closed = 0;
+
+    if (!PyArg_ParseTuple(args, "O:__on_recv__", &result)) {
+        return NULL;
+    }
+    if (!__conn_closed(self)) {
+        if (PyExceptionInstance_Check(result)) {
+            __connection_error(self, CONN_ERROR, result,
+                               "error while reading data");
+        }
+        else if (
+            ((closed = PyObject_Not(result)) == -1) ||
+            __connection_data(self, closed)
+           ) {
+            return NULL;
+        }
+    }
+    Py_RETURN_NONE;
+}
+
+
+/* Connection.__on_send__(result) */
+PyDoc_STRVAR(Connection___on_send___doc,
+"__on_send__(result)");
+
+// ring callback
+static PyObject *
+Connection___on_send__(Connection *self, PyObject *args)
+{
+    PyObject *result = NULL;
+    ConnTask task;
+    int res = 0;
+
+    if (!PyArg_ParseTuple(args, "O:__on_send__", &result)) {
+        return NULL;
+    }
+    self->writing = 0;
+    if (!__conn_closed(self)) {
+        if (PyExceptionInstance_Check(result)) {
+            __connection_error(self, CONN_ERROR, result,
+                               "error while writing data");
+        }
+        else if (self->wtasks.len) {
+            __queue_popleft(&self->wtasks, &task);
+            self->wsize -= task.size; // buf was consumed by the ring
+            if (!(res = __connection_send(self)) && task.callback) {
+                res = __connection_run(self, task.callback, NULL, task.args);
+            }
+            __task_clear(&task);
+            if (!res && self->paused && (self->wsize <= self->low)) {
+                res = __connection_resume(self);
+            }
+        }
+    }
+    return (res) ? NULL : __Py_INCREF(Py_None);
+}
+
+#endif /* HAVE_IO_URING */
+
+
+/* Connection_Type.tp_methods */
+static PyMethodDef Connection_tp_methods[] = {
+    {"close", (PyCFunction)Connection_close,
+     METH_VARARGS | METH_KEYWORDS, Connection_close_doc},
+    {"read", (PyCFunction)Connection_read,
+     METH_VARARGS, Connection_read_doc},
+    {"receive", (PyCFunction)Connection_receive,
+     METH_VARARGS, Connection_receive_doc},
+    {"write", (PyCFunction)Connection_write,
+     METH_VARARGS | METH_KEYWORDS, Connection_write_doc},
+    {"watermarks", (PyCFunction)Connection_watermarks,
+     METH_VARARGS | METH_KEYWORDS, Connection_watermarks_doc},
+    {"__on_read__", (PyCFunction)Connection___on_read__,
+     METH_VARARGS, Connection___on_read___doc},
+    {"__on_write__", (PyCFunction)Connection___on_write__,
+     METH_VARARGS, Connection___on_write___doc},
+    {"__push__", (PyCFunction)Connection___push__,
+     METH_NOARGS, Connection___push___doc},
+    {"__handshake__", (PyCFunction)Connection___handshake__,
+     METH_NOARGS, Connection___handshake___doc},
+    {"__stop__", (PyCFunction)Connection___stop__,
+     METH_NOARGS, Connection___stop___doc},
+    {"__cleanup__", (PyCFunction)Connection___cleanup__,
+     METH_NOARGS, Connection___cleanup___doc},
+#ifdef HAVE_IO_URING
+    {"__on_recv__", (PyCFunction)Connection___on_recv__,
+     METH_VARARGS, Connection___on_recv___doc},
+    {"__on_send__", (PyCFunction)Connection___on_send__,
+     METH_VARARGS, Connection___on_send___doc},
+#endif
+    {NULL}  /* Sentinel */
+};
+
+
+/* Connection_Type.tp_members */
+static PyMemberDef Connection_tp_members[] = {
+    {"_rbuf", T_OBJECT, offsetof(Connection, rbuf), READONLY, NULL},
+    {"_reader", T_OBJECT, offsetof(Connection, reader), 0, NULL},
+    {"_logger", T_OBJECT, offsetof(Connection, logger), 0, NULL},
+    {"_on_close", T_OBJECT, offsetof(Connection, on_close), 0, NULL},
+    {"_on_pressure", T_OBJECT, offsetof(Connection, on_pressure), 0, NULL},
+    {"_coalesce", T_PYSSIZET, offsetof(Connection, coalesce), 0, NULL},
+    {"_wsize", T_PYSSIZET, offsetof(Connection, wsize), READONLY, NULL},
+    {"_high", T_PYSSIZET, offsetof(Connection, high), READONLY, NULL},
+    {"_low", T_PYSSIZET, offsetof(Connection, low), READONLY, NULL},
+    {"_draining", T_BOOL, offsetof(Connection, draining), READONLY, NULL},
+    {"_paused", T_BOOL, offsetof(Connection, paused), READONLY, NULL},
+    {"_closing", T_BOOL, offsetof(Connection, closing), READONLY, NULL},
+    {NULL}  /* Sentinel */
+};
+
+
+/* Connection.closed */
+static PyObject *
+Connection_closed_get(Connection *self, void *closure)
+{
+    return PyBool_FromLong(__conn_closed(self));
+}
+
+
+/* Connection._socket */
+static PyObject *
+Connection_socket_get(Connection *self, void *closure)
+{
+    return __Py_INCREF((self->socket) ? (PyObject *)self->socket : Py_None);
+}
+
+static int
+Connection_socket_set(Connection *self, PyObject *value, void *closure)
+{
+    if (!value || !PyObject_TypeCheck(value, &Socket_Type)) {
+        PyErr_SetString(PyExc_TypeError, "_socket must be a socket");
+        return -1;
+    }
+    Py_INCREF(value);
+    Py_XSETREF(self->socket, (Abstract *)value);
+    if (self->socket->memfd) {
+        // a merged buffer must not be mistaken for a memfd frame
+        self->coalesce = Py_MIN(self->coalesce, (self->socket->memfd - 1));
+    }
+    return 0;
+}
+
+
+/* Connection._transport */
+static PyObject *
+Connection_transport_get(Connection *self, void *closure)
+{
+    return __Py_INCREF((self->transport) ? self->transport : Py_None);
+}
+
+static int
+Connection_transport_set(Connection *self, PyObject *value, void *closure)
+{
+    if (
+        !value ||
+        !(PyObject_TypeCheck(value, &Socket_Type) ||
+          PyObject_TypeCheck(value, &Channel_Type))
+       ) {
+        PyErr_SetString(PyExc_TypeError,
+                        "_transport must be a socket or a channel");
+        return -1;
+    }
+    _Py_SET_MEMBER(self->transport, value);
+    return 0;
+}
+
+
+/* Connection._writer */
+static PyObject *
+Connection_writer_get(Connection *self, void *closure)
+{
+    return __Py_INCREF((self->writer) ? self->writer : Py_None);
+}
+
+static int
+Connection_writer_set(Connection *self, PyObject *value, void *closure)
+{
+    // a new writer starts stopped, the old one must be stopped already
+    Py_XINCREF(value);
+    Py_XSETREF(self->writer, value);
+    self->writing = 0;
+    return 0;
+}
+
+
+#ifdef HAVE_IO_URING
+
+/* Connection._ring */
+static PyObject *
+Connection_ring_get(Connection *self, void *closure)
+{
+    return __Py_INCREF((self->ring) ? (PyObject *)self->ring : Py_None);
+}
+
+static int
+Connection_ring_set(Connection *self, PyObject *value, void *closure)
+{
+    if (value && (value != Py_None) && !PyObject_TypeCheck(value, &Ring_Type)) {
+        PyErr_SetString(PyExc_TypeError, "_ring must be a ring or None");
+        return -1;
+    }
+    if (value == Py_None) {
+        value = NULL;
+    }
+    Py_XINCREF(value);
+    Py_XSETREF(self->ring, (Ring *)value);
+    return 0;
+}
+
+#endif /* HAVE_IO_URING */
+
+
+/* Connection._rtasks */
+static PyObject *
+Connection_rtasks_get(Connection *self, void *closure)
+{
+    return PyLong_FromSsize_t(self->rtasks.len);
+}
+
+
+/* Connection._wtasks */
+static PyObject *
+Connection_wtasks_get(Connection *self, void *closure)
+{
+    return PyLong_FromSsize_t(self->wtasks.len);
+}
+
+
+/* Connection._stamp */
+static PyObject *
+Connection_stamp_get(Connection *self, void *closure)
+{
+    // on the time.monotonic() clock
+    return PyFloat_FromDouble((double)self->stamp / 1e9);
+}
+
+
+/* Connection_Type.tp_getset */
+static PyGetSetDef Connection_tp_getset[] = {
+    {"closed", (getter)Connection_closed_get, _Py_READONLY_ATTRIBUTE, NULL, NULL},
+    {"_socket", (getter)Connection_socket_get,
+     (setter)Connection_socket_set, NULL, NULL},
+    {"_transport", (getter)Connection_transport_get,
+     (setter)Connection_transport_set, NULL, NULL},
+    {"_writer", (getter)Connection_writer_get,
+     (setter)Connection_writer_set, NULL, NULL},
+#ifdef HAVE_IO_URING
+    {"_ring", (getter)Connection_ring_get,
+     (setter)Connection_ring_set, NULL, NULL},
+#endif
+    {"_rtasks", (getter)Connection_rtasks_get, _Py_READONLY_ATTRIBUTE, NULL, NULL},
+    {"_wtasks", (getter)Connection_wtasks_get, _Py_READONLY_ATTRIBUTE, NULL, NULL},
+    {"_stamp", (getter)Connection_stamp_get, _Py_READONLY_ATTRIBUTE, NULL, NULL},
+    {NULL}  /* Sentinel */
+};
+
+
+static PyTypeObject Connection_Type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "mood.ippc.sockets.Connection",
+    .tp_basicsize = sizeof(Connection),
+    .tp_dealloc = (destructor)Connection_tp_dealloc,
+    .tp_flags = (Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE | Py_TPFLAGS_HAVE_GC),
+    .tp_traverse = (traverseproc)Connection_tp_traverse,
+    .tp_clear = (inquiry)Connection_tp_clear,
+    .tp_methods = Connection_tp_methods,
+    .tp_members = Connection_tp_members,
+    .tp_getset = Connection_tp_getset,
+    .tp_new = Connection_tp_new,
+};
+
+
+/* --------------------------------------------------------------------------
+   module
+   -------------------------------------------------------------------------- */
+
+/* sockets_def */
+static PyModuleDef sockets_def = {
+    PyModuleDef_HEAD_INIT,
+    .m_name = "ippc.sockets",
+    .m_doc = "ippc.sockets module",
+    .m_size = 0,
+};
+
+
+static inline int
+_module_init(PyObject *module)
+{
+    if (
+        PyModule_AddStringConstant(module, "__version__", PKG_VERSION) ||
+        PyModule_AddIntConstant(module, "MEMFD_FRAME", SOCK_MEMFD_FRAME) ||
+        PyType_Ready(&Abstract_Type) ||
+        _PyType_ReadyWithBase(&Socket_Type, &Abstract_Type) ||
+        _PyModule_AddTypeWithBase(module, "ServerSocket", &Server_Type, &Abstract_Type) ||
+        _PyModule_AddTypeWithBase(module, "ClientSocket", &Client_Type, &Socket_Type) ||
+        _PyModule_AddType(module, "Channel", &Channel_Type) ||
+        _PyModule_AddType(module, "Connection", &Connection_Type)
+       ) {
+        return -1;
+    }
+#ifdef HAVE_IO_URING
+    if (_PyModule_AddType(module, "Ring", &Ring_Type)) {
         return -1;
     }
+#endif
     return 0;
 }
 